@@ -77,6 +77,8 @@ int CarDataClass::setCarDataFromFile(char* carDataPath) {
   _regenLostFreq = j["regenLostFreq"].get<float>();
   _modulationMax = j["modulationMax"].get<float>();
   _modulationMaxFreq = j["modulationMaxFreq"].get<float>();
+  _motorInductance = !j["motorInductance"].is_null() ? j["motorInductance"].get<float>() : 0;
+  _motorResistance = !j["motorResistance"].is_null() ? j["motorResistance"].get<float>() : 0;
   _pmNum = j["pulseMode"].size();
   for (size_t i = 0; i < _pmNum; i++) {
     _listFs[i]     = !j["pulseMode"][i]["fs"].is_null()     ? j["pulseMode"][i]["fs"].get<float>()     : 0;
@@ -86,9 +88,55 @@ int CarDataClass::setCarDataFromFile(char* carDataPath) {
     _listFrand2[i] = !j["pulseMode"][i]["frand2"].is_null() ? j["pulseMode"][i]["frand2"].get<float>() : 0;
     _listMode[i]   = !j["pulseMode"][i]["mode"].is_null()   ? j["pulseMode"][i]["mode"].get<int>()     : 0;
     _listNpulse[i] = !j["pulseMode"][i]["Npulse"].is_null() ? j["pulseMode"][i]["Npulse"].get<int>()   : 0;
+
+    // スイッチング角. 角度の数が1行目と異なる行は読み飛ばす
+    _listAngleRowNum[i] = 0;
+    _listAngleNum[i] = 0;
+    const nlohmann::json& angles = j["pulseMode"][i]["angles"];
+    if (angles.is_array() && !angles.empty() && angles[0].is_array() && angles[0].size() >= 1) {
+      size_t angleNum = angles[0].size() - 1;
+      if (angleNum > CARDATA_MAX_ANGLE_NUM) angleNum = CARDATA_MAX_ANGLE_NUM;
+      _listAngleNum[i] = angleNum;
+      for (size_t r = 0; r < angles.size() && _listAngleRowNum[i] < CARDATA_MAX_ANGLE_ROW_NUM; r++) {
+        if (!angles[r].is_array() || angles[r].size() != angleNum + 1) continue;
+        size_t row = _listAngleRowNum[i]++;
+        _listAngleVs[i][row] = angles[r][0].get<float>();
+        for (size_t a = 0; a < angleNum; a++) {
+          _listAngle[i][row][a] = angles[r][a + 1].get<float>() / 360.0f;  // [deg] -> 信号波1周期を1とする位相
+        }
+      }
+    }
+  }
+
+  // モーター音の高調波セット. 不正な高調波は読み飛ばす
+  const nlohmann::json& motorSound = j["motorSound"];
+  if (motorSound.is_array()) {
+    _motorSetNum = 0;
+    for (size_t i = 0; i < motorSound.size() && _motorSetNum < CARDATA_MAX_MOTOR_SET_NUM; i++) {
+      nlohmann::json& set = j["motorSound"][i];
+      int source = !set["source"].is_null() ? set["source"].get<int>() : 0;
+      if (source < 0 || source >= MOTOR_SOUND_SOURCE_NUM) continue;
+      size_t m = _motorSetNum++;
+      _listMotorSource[m] = source;
+      _listMotorRpsStart[m] = !set["rpsStart"].is_null() ? set["rpsStart"].get<float>() : 0;
+      _listMotorRpsFull[m]  = !set["rpsFull"].is_null()  ? set["rpsFull"].get<float>()  : 0;
+      _listMotorPartialNum[m] = 0;
+      const nlohmann::json& harmonics = set["harmonics"];
+      for (size_t h = 0; h < harmonics.size() && _listMotorPartialNum[m] < CARDATA_MAX_MOTOR_PARTIAL_NUM; h++) {
+        if (!harmonics[h].is_array() || harmonics[h].size() != 2) continue;
+        int order = harmonics[h][0].get<int>();
+        if (order < 1) continue;
+        size_t n = _listMotorPartialNum[m]++;
+        _listMotorPartialOrder[m][n] = order;
+        _listMotorPartialWeight[m][n] = harmonics[h][1].get<float>();
+      }
+    }
+  } else {
+    setDefaultMotorSound();  // 省略時は既定値. 前に読み込んだ車両の設定を残さない
   }
 #endif
 
+  buildLookup();
   return 1;
 }
 
@@ -103,6 +151,8 @@ void CarDataClass::clearCarData() {
   _regenLostFreq = 0;
   _modulationMax = 0;
   _modulationMaxFreq = 0;
+  _motorInductance = 0;
+  _motorResistance = 0;
   _pmNum = 0;
   for (size_t i = 0; i < CARDATA_MAX_PULSEMODE_NUM; i++) {
     _listFs[i]     = 0;
@@ -112,5 +162,91 @@ void CarDataClass::clearCarData() {
     _listFrand2[i] = 0;
     _listMode[i]   = 0;
     _listNpulse[i] = 0;
+    _listAngleRowNum[i] = 0;
+    _listAngleNum[i] = 0;
+  }
+  setDefaultMotorSound();
+  buildLookup();
+}
+
+void CarDataClass::setDefaultMotorSound() {
+  // 回転子: 回転数の4,8,...,24倍. 回転数30Hzから鳴り始め、60Hzで最大
+  static const int rotorOrder[] = {4, 8, 12, 16, 20, 24};
+  static const float rotorWeight[] = {1.0f/2, 1.0f/2, 1.0f/3, 1.0f/5, 1.0f/7, 1.0f/9};
+  // 歯車の噛み合い: 噛み合い周波数の1,2,3,5倍. 30Hzから鳴り始め、330Hzで最大
+  static const int meshOrder[] = {1, 2, 3, 5};
+  static const float meshWeight[] = {1.0f, 1.0f/2, 1.0f, 1.0f};
+
+  _motorSetNum = 2;
+  _listMotorSource[0] = MOTOR_SOUND_ROTOR;
+  _listMotorRpsStart[0] = 30;
+  _listMotorRpsFull[0] = 60;
+  _listMotorPartialNum[0] = sizeof(rotorOrder) / sizeof(rotorOrder[0]);
+  for (size_t n = 0; n < _listMotorPartialNum[0]; n++) {
+    _listMotorPartialOrder[0][n] = rotorOrder[n];
+    _listMotorPartialWeight[0][n] = rotorWeight[n];
+  }
+  _listMotorSource[1] = MOTOR_SOUND_MESH;
+  _listMotorRpsStart[1] = 30;
+  _listMotorRpsFull[1] = 330;
+  _listMotorPartialNum[1] = sizeof(meshOrder) / sizeof(meshOrder[0]);
+  for (size_t n = 0; n < _listMotorPartialNum[1]; n++) {
+    _listMotorPartialOrder[1][n] = meshOrder[n];
+    _listMotorPartialWeight[1][n] = meshWeight[n];
+  }
+}
+
+void CarDataClass::buildLookup() {
+  // パルスモード検索表: 各1Hz区間の下端 b[Hz] において fs >= _listFs[i] を満たす最大の i
+  int i = -1;
+  for (int b = 0; b < CARDATA_FS_LUT_SIZE; b++) {
+    while (i + 1 < static_cast<int>(_pmNum) && b >= _listFs[i + 1]) i++;
+    _fsLut[b] = i;
+  }
+
+  // 非同期キャリアの一次関数の係数. 右端は次のパルスモードの開始周波数(最後のモードでは左端+1Hz)
+  for (size_t m = 0; m < CARDATA_MAX_PULSEMODE_NUM; m++) {
+    if (m >= _pmNum) {
+      _listFcSlope[m] = 0;  _listFcIntercept[m] = 0;
+      _listFrandSlope[m] = 0;  _listFrandIntercept[m] = 0;
+      continue;
+    }
+    float fs1 = _listFs[m];
+    float fs2 = (m == _pmNum - 1) ? fs1 + 1.0f : _listFs[m + 1];
+    _listFcSlope[m] = (_listFc2[m] - _listFc1[m]) / (fs2 - fs1);
+    _listFcIntercept[m] = _listFc1[m] - _listFcSlope[m] * fs1;
+    _listFrandSlope[m] = (_listFrand2[m] - _listFrand1[m]) / (fs2 - fs1);
+    _listFrandIntercept[m] = _listFrand1[m] - _listFrandSlope[m] * fs1;
+  }
+
+  // モーター音の重みの表. 次数の最大公約数を基本次数とすると、Clenshaw 法の漸化式の長さが 最大次数/基本次数 で済む
+  for (size_t m = 0; m < CARDATA_MAX_MOTOR_SET_NUM; m++) {
+    for (int n = 0; n < CARDATA_MAX_MOTOR_ORDER_NUM; n++) {
+      _listMotorWeight[m][n] = 0;
+    }
+    _listMotorBaseOrder[m] = 1;
+    _listMotorOrderNum[m] = 0;
+    _listMotorEnvSlope[m] = 0;
+    if (m >= _motorSetNum) continue;
+
+    int base = 0;
+    for (size_t n = 0; n < _listMotorPartialNum[m]; n++) {
+      int a = _listMotorPartialOrder[m][n];
+      while (a != 0) {
+        int t = base % a;
+        base = a;
+        a = t;
+      }
+    }
+    if (base == 0) continue;  // 高調波がない
+    _listMotorBaseOrder[m] = base;
+    for (size_t n = 0; n < _listMotorPartialNum[m]; n++) {
+      int k = _listMotorPartialOrder[m][n] / base;
+      if (k > CARDATA_MAX_MOTOR_ORDER_NUM) continue;  // 表に収まらない高次の高調波は鳴らさない
+      _listMotorWeight[m][k - 1] += _listMotorPartialWeight[m][n];
+      if (k > _listMotorOrderNum[m]) _listMotorOrderNum[m] = k;
+    }
+    float width = _listMotorRpsFull[m] - _listMotorRpsStart[m];
+    _listMotorEnvSlope[m] = (width > 0) ? 1.0f / width : 1e30f;  // 幅0以下は rpsStart を超えたら最大
   }
 }
@@ -6,6 +6,15 @@ class CarDataClass {
  private:
   static const size_t CARDATA_MAX_NAME_SIZE = 32;
   static const size_t CARDATA_MAX_PULSEMODE_NUM = 16;
+  static const int CARDATA_FS_LUT_SIZE = 256;  // パルスモード検索表の大きさ. 1Hz刻みで 0-255Hz を受け持つ
+  static const size_t CARDATA_MAX_ANGLE_ROW_NUM = 8;  // 1つのパルスモードに持てるスイッチング角の行(Vsごとの組)の数
+
+  /// @brief _listFs 等から、パルスモード検索表と非同期キャリアの一次関数の係数を作成する.
+  ///        モーター音の高調波セットからは、Clenshaw 法で引ける密な重みの表を作成する
+  void buildLookup();
+
+  /// @brief モーター音の高調波セットを既定値(JSONで指定しない場合の音)にする
+  void setDefaultMotorSound();
 
  public:
   CarDataClass();
@@ -20,6 +29,20 @@ class CarDataClass {
   /// @brief セットされている車両データを消去する
   void clearCarData();
 
+  /// @brief 周波数fsに対応するパルスモードを取得する. 1Hz刻みの検索表を引いたのち、
+  ///        同じ1Hzの区間内にあるパルスモードの境界だけを比較するので、計算量はパルスモード数によらずほぼ一定
+  /// @param[in] fs 信号波周波数[Hz]
+  /// @retval パルスモードのインデックス(0,1,...,_pmNum-1). fsが _listFs[0] 未満の場合は -1
+  inline int getPulsemodeIndex(const float fs) const {
+    int b = static_cast<int>(fs);
+    if (b < 0) b = 0;
+    if (b >= CARDATA_FS_LUT_SIZE) b = CARDATA_FS_LUT_SIZE - 1;
+    int i = _fsLut[b];
+    while (i + 1 < static_cast<int>(_pmNum) && fs >= _listFs[i + 1]) i++;
+    while (i >= 0 && fs < _listFs[i]) i--;
+    return i;
+  }
+
 
   // 車両データを表すjson文字列へのポインタ
   char* _carDataStr;
@@ -34,6 +57,8 @@ class CarDataClass {
   float _regenLostFreq;
   float _modulationMax;
   float _modulationMaxFreq;
+  float _motorInductance;  // 主電動機の1相あたりのインダクタンス[H]. 0のときは未設定
+  float _motorResistance;  // 主電動機の1相あたりの抵抗[Ω]. 0のときは未設定
 
   // パルスモードに関するデータ
   size_t _pmNum = 0;  // パルスモードの数
@@ -44,11 +69,53 @@ class CarDataClass {
   float _listFrand2[CARDATA_MAX_PULSEMODE_NUM];
   int _listMode[CARDATA_MAX_PULSEMODE_NUM];
   int _listNpulse[CARDATA_MAX_PULSEMODE_NUM];
+
+  // スイッチング角を指定するパルスモード(SYNC_ANGLE)のデータ. JSONでは "angles": [[Vs, 角度1, 角度2, ...], ...] の形で、
+  // 信号波の1/4周期内のスイッチング角[deg]を昇順に、行はVsの昇順に並べる. 行間のVsでは角度を線形補間する
+  static const size_t CARDATA_MAX_ANGLE_NUM = 8;  // 1/4周期あたりのスイッチング角の数の上限
+  size_t _listAngleRowNum[CARDATA_MAX_PULSEMODE_NUM];  // 行の数
+  size_t _listAngleNum[CARDATA_MAX_PULSEMODE_NUM];     // 1行あたりのスイッチング角の数
+  float _listAngleVs[CARDATA_MAX_PULSEMODE_NUM][CARDATA_MAX_ANGLE_ROW_NUM];  // 各行のVs
+  float _listAngle[CARDATA_MAX_PULSEMODE_NUM][CARDATA_MAX_ANGLE_ROW_NUM][CARDATA_MAX_ANGLE_NUM];  // スイッチング角. 1で信号波1周期(0 to 0.25)
+
+  // モーター音(MotorSoundClass)の高調波セット. JSONでは
+  // "motorSound": [{"source": 0, "rpsStart": 30, "rpsFull": 60, "harmonics": [[次数, 重み], ...]}, ...] の形で指定する.
+  // source は MotorSoundSource で、次数はその基本周波数に対する倍数. 振幅は基本周波数[Hz]が rpsStart で0、rpsFull で1になるよう線形に変化する.
+  // 省略した場合は setDefaultMotorSound() の既定値を使う
+  static const size_t CARDATA_MAX_MOTOR_SET_NUM = 4;      // 高調波セットの数の上限
+  static const size_t CARDATA_MAX_MOTOR_PARTIAL_NUM = 8;  // 1セットあたりの高調波の数の上限
+  static const int CARDATA_MAX_MOTOR_ORDER_NUM = 32;      // 基本次数の何倍までの高調波を持てるか(HarmonicOscillator::ORDER_MAX 以下)
+  size_t _motorSetNum;  // 高調波セットの数
+  int _listMotorSource[CARDATA_MAX_MOTOR_SET_NUM];
+  float _listMotorRpsStart[CARDATA_MAX_MOTOR_SET_NUM];
+  float _listMotorRpsFull[CARDATA_MAX_MOTOR_SET_NUM];
+  size_t _listMotorPartialNum[CARDATA_MAX_MOTOR_SET_NUM];  // 高調波の数
+  int _listMotorPartialOrder[CARDATA_MAX_MOTOR_SET_NUM][CARDATA_MAX_MOTOR_PARTIAL_NUM];     // 次数(1以上)
+  float _listMotorPartialWeight[CARDATA_MAX_MOTOR_SET_NUM][CARDATA_MAX_MOTOR_PARTIAL_NUM];  // 重み
+
+  // buildLookup() で作成される派生データ
+  int8_t _fsLut[CARDATA_FS_LUT_SIZE];  // fsの整数部[Hz] -> その1Hz区間の下端で適用されるパルスモード(-1はなし)
+  float _listFcSlope[CARDATA_MAX_PULSEMODE_NUM];         // 非同期キャリア周波数 fc = _listFcSlope * fs + _listFcIntercept
+  float _listFcIntercept[CARDATA_MAX_PULSEMODE_NUM];
+  float _listFrandSlope[CARDATA_MAX_PULSEMODE_NUM];      // ランダム変調幅 frand = _listFrandSlope * fs + _listFrandIntercept
+  float _listFrandIntercept[CARDATA_MAX_PULSEMODE_NUM];
+  int _listMotorBaseOrder[CARDATA_MAX_MOTOR_SET_NUM];  // 基本次数. セット内の次数の最大公約数
+  int _listMotorOrderNum[CARDATA_MAX_MOTOR_SET_NUM];   // 密な重みの数 = 最大次数/基本次数. 0のセットは鳴らさない
+  float _listMotorWeight[CARDATA_MAX_MOTOR_SET_NUM][CARDATA_MAX_MOTOR_ORDER_NUM];  // [n-1] が (n*基本次数)次の重み. 指定のない次数は0
+  float _listMotorEnvSlope[CARDATA_MAX_MOTOR_SET_NUM];  // 振幅 = (基本周波数 - rpsStart) * _listMotorEnvSlope を0から1に制限したもの
 };
 
   typedef enum Mode {
-    ASYNC,
-    SYNC,
-    SYNC_W3P,
+    ASYNC,       // 非同期
+    SYNC,        // 同期. パルス数は Npulse
+    SYNC_W3P,    // 広域3パルス. 1/4周期に1つのスイッチング角をVsから求め、Vs=1で1パルスになる
+    SYNC_1P,     // 1パルス
+    SYNC_ANGLE,  // スイッチング角をJSONの "angles" で指定する(選択高調波除去など)
     CARDATA_MODE_NUM
   } Mode;
+
+  typedef enum MotorSoundSource {
+    MOTOR_SOUND_ROTOR,  // 回転子(小歯車)の回転数[Hz]を基本周波数とする
+    MOTOR_SOUND_MESH,   // 歯車の噛み合い周波数(回転数×小歯車の歯数)を基本周波数とする. 惰行時は鳴らさない
+    MOTOR_SOUND_SOURCE_NUM
+  } MotorSoundSource;
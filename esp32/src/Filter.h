@@ -1,5 +1,11 @@
 #pragma once
 
+#include "constant.h"
+#include "Simd.h"
+#ifndef ARDUINO_ARCH_ESP32
+#include <math.h>
+#endif
+
 class FirstLPF {
   private:
   float _tau;   // 1次遅れ時定数[s]
@@ -111,3 +117,218 @@ class FirstAPF {
     return _y[0];
   }
 };
+
+/// @brief y[n] = a*y[n-1] + b*x[n] の1次IIRフィルタ. 配列を Vec4f::WIDTH サンプルずつまとめて処理する.
+///        ブロックの各出力は直前のブロックの最後の出力とブロック内の入力の一次結合
+///          y[n+k] = a^(k+1)*y[n-1] + Σ_{j<=k} b*a^(k-j)*x[n+j]
+///        で書けるので、サンプル間の依存は Vec4f::WIDTH サンプルに1回になる
+class FirstIIR {
+  private:
+  float _a;   // 帰還係数
+  float _b;   // 入力係数
+  float _aPow[Vec4f::WIDTH];  // a^(k+1) (k=0,1,...)
+  float _col[Vec4f::WIDTH][Vec4f::WIDTH];  // ブロック内のj番目の入力が各出力kに寄与する係数 b*a^(k-j) (k<jでは0)
+  float _y1;  // ひとつ前のy
+
+  public:
+  FirstIIR() : _a(0.0f), _b(0.0f), _y1(0.0f) {
+    setCoeff(0.0f, 0.0f);
+  }
+  ~FirstIIR() {};
+
+  /// @brief 係数を設定する
+  /// @param[in] a 帰還係数(|a|<1)
+  /// @param[in] b 入力係数
+  void setCoeff(const float a, const float b) {
+    _a = a;
+    _b = b;
+    float p = 1.0f;
+    for (int k = 0; k < Vec4f::WIDTH; k++) {
+      p *= a;
+      _aPow[k] = p;
+    }
+    for (int j = 0; j < Vec4f::WIDTH; j++) {
+      float c = b;
+      for (int k = 0; k < Vec4f::WIDTH; k++) {
+        if (k < j) {
+          _col[j][k] = 0.0f;
+        } else {
+          _col[j][k] = c;
+          c *= a;
+        }
+      }
+    }
+  }
+
+  /// @brief 内部変数をリセット
+  /// @param[in] init yをリセットする初期値
+  void clear(const float init) {
+    _y1 = init;
+  }
+
+  /// @brief 入力の配列から出力の配列を計算する
+  /// @param[in] x 入力の配列
+  /// @param[out] y 出力の配列. x と同じ配列を指定してもよい
+  /// @param[in] num 要素数
+  inline void process(const float* x, float* y, const size_t num) {
+    size_t n = 0;
+    for (; n + Vec4f::WIDTH <= num; n += Vec4f::WIDTH) {
+      Vec4f acc = Vec4f::load(_aPow) * Vec4f::set1(_y1);
+      for (int j = 0; j < Vec4f::WIDTH; j++) {
+        acc = acc + Vec4f::load(_col[j]) * Vec4f::set1(x[n + j]);
+      }
+      acc.store(&y[n]);
+      _y1 = y[n + Vec4f::WIDTH - 1];
+    }
+    for (; n < num; n++) {
+      _y1 = _a * _y1 + _b * x[n];
+      y[n] = _y1;
+    }
+  }
+};
+
+/// @brief 2:1のポリフェーズ・ハーフバンドデシメータ. 2サンプル入力するごとに、帯域を半分に制限した1サンプルを出力する.
+///        ハーフバンドFIRは中央以外の偶数番目の係数が0なので、奇数番目の係数(左右対称)と中央タップだけを計算する
+class HalfbandDecimator {
+  private:
+  static const int MAX_TAPS = 47;  // タップ数の最大値
+  int _taps;       // タップ数(4k+3)
+  int _coefNum;    // 中央から奇数個離れたタップの係数の数(片側)
+  float _coef[(MAX_TAPS + 1) / 4];  // 中央から 1,3,5,... 離れたタップの係数
+  float _x[2 * MAX_TAPS];  // 入力の遅延線. 同じ値を _pos と _pos+_taps の2か所に書き、常に連続した窓として読めるようにする
+  int _pos;        // 次に書き込む位置
+
+  inline void push(const float x) {
+    _x[_pos] = x;
+    _x[_pos + _taps] = x;
+    _pos = (_pos + 1 < _taps) ? _pos + 1 : 0;
+  }
+
+  public:
+  HalfbandDecimator() : _taps(3), _coefNum(1), _pos(0) {
+    setTaps(_taps);
+  }
+  ~HalfbandDecimator() {};
+
+  /// @brief タップ数を設定し、Blackman窓をかけたsinc関数で係数を設計する. 内部変数はリセットされる
+  /// @param[in] taps タップ数. 4k+3 (k=0,1,...) の形で MAX_TAPS 以下であること
+  /// @retval 1:success, 0:fail
+  int setTaps(const int taps) {
+    if (taps < 3 || taps > MAX_TAPS || (taps - 3) % 4 != 0) {
+      return 0;
+    }
+    _taps = taps;
+    _coefNum = (taps + 1) / 4;
+    const int M = (taps - 1) / 2;  // 中央から端までの距離
+    float sum = 0.0;
+    for (int j = 0; j < _coefNum; j++) {
+      int n = 2 * j + 1;
+      float sinc = sin(0.5 * PI * n) / (0.5 * PI * n);
+      float window = 0.42 + 0.5 * cos(PI * n / (M + 1)) + 0.08 * cos(2.0 * PI * n / (M + 1));
+      _coef[j] = 0.5 * sinc * window;
+      sum += _coef[j];
+    }
+    for (int j = 0; j < _coefNum; j++) {
+      _coef[j] *= 0.25 / sum;  // 直流ゲインを1にする(中央タップ0.5 + 両側の和0.5)
+    }
+    clear(0.0);
+    return 1;
+  }
+
+  /// @brief 内部変数をリセット
+  /// @param[in] init 遅延線をリセットする初期値
+  void clear(const float init) {
+    for (int i = 0; i < 2 * MAX_TAPS; i++) _x[i] = init;
+    _pos = 0;
+  }
+
+  /// @brief 2サンプル入力し、1サンプル出力する
+  /// @param[in] x0 入力(古い方)
+  /// @param[in] x1 入力(新しい方)
+  /// @retval y 出力
+  inline float process(const float x0, const float x1) {
+    push(x0);
+    push(x1);
+    const float* w = &_x[_pos];  // 古い順に _taps 個並んだ窓
+    const int c = (_taps - 1) / 2;
+    float y = 0.5f * w[c];
+    for (int j = 0; j < _coefNum; j++) {
+      y += _coef[j] * (w[c - 2 * j - 1] + w[c + 2 * j + 1]);
+    }
+    return y;
+  }
+};
+
+#ifdef USE_FIXED_POINT
+/// @brief FirstLPF の固定小数点版. 係数はQ30で、入出力は任意の固定小数点形式の整数
+class FirstLPFQ {
+  private:
+  int32_t _a;   // (2τ-dt)/(2τ+dt) のQ30表現
+  int32_t _b;   // dt/(2τ+dt) のQ30表現
+  int32_t _x1;  // ひとつ前のx
+  int32_t _y1;  // ひとつ前のy
+
+  public:
+  FirstLPFQ() : _a(0), _b(0), _x1(0), _y1(0) {}
+  ~FirstLPFQ() {};
+
+  /// @brief 一次遅れ時定数を設定
+  /// @param[in] tau 一次遅れ時定数[s]
+  /// @param[in] dt サンプリング周期[s]
+  void setTau(const float tau, const float dt) {
+    _a = static_cast<int32_t>((2.0f*tau - dt) / (2.0f*tau + dt) * (1 << 30));
+    _b = static_cast<int32_t>(dt / (2.0f*tau + dt) * (1 << 30));
+  }
+
+  /// @brief 内部変数をリセット
+  /// @param[in] init xとyをリセットする初期値
+  void clear(const int32_t init) {
+    _x1 = init; _y1 = init;
+  }
+
+  /// @brief 入力から出力を計算
+  /// @param[in] x 入力
+  /// @retval y 出力
+  inline int32_t update(const int32_t x) {
+    _y1 = static_cast<int32_t>(((int64_t)_a * _y1 + (int64_t)_b * (x + _x1)) >> 30);
+    _x1 = x;
+    return _y1;
+  }
+};
+
+/// @brief FirstHPF の固定小数点版. 係数はQ30で、入出力は任意の固定小数点形式の整数
+class FirstHPFQ {
+  private:
+  int32_t _a;   // (2τ-dt)/(2τ+dt) のQ30表現
+  int32_t _c;   // 2τ/(2τ+dt) のQ30表現
+  int32_t _x1;  // ひとつ前のx
+  int32_t _y1;  // ひとつ前のy
+
+  public:
+  FirstHPFQ() : _a(0), _c(0), _x1(0), _y1(0) {}
+  ~FirstHPFQ() {};
+
+  /// @brief 一次進み時定数を設定
+  /// @param[in] tau 一次進み時定数[s]
+  /// @param[in] dt サンプリング周期[s]
+  void setTau(const float tau, const float dt) {
+    _a = static_cast<int32_t>((2.0f*tau - dt) / (2.0f*tau + dt) * (1 << 30));
+    _c = static_cast<int32_t>(2.0f*tau / (2.0f*tau + dt) * (1 << 30));
+  }
+
+  /// @brief 内部変数をリセット
+  /// @param[in] init xとyをリセットする初期値
+  void clear(const int32_t init) {
+    _x1 = init; _y1 = init;
+  }
+
+  /// @brief 入力から出力を計算
+  /// @param[in] x 入力
+  /// @retval y 出力
+  inline int32_t update(const int32_t x) {
+    _y1 = static_cast<int32_t>(((int64_t)_a * _y1 + (int64_t)_c * (x - _x1)) >> 30);
+    _x1 = x;
+    return _y1;
+  }
+};
+#endif
@@ -12,7 +12,7 @@ JointSoundClass::SoundSourceClass::SoundSourceClass(const SoundSourceClass& obj)
     : id(obj.id), speed(obj.speed), minSpeed(obj.minSpeed), interceptPitch(obj.interceptPitch), interceptVolume(obj.interceptVolume), buf(obj.buf), size(obj.size) {}
 JointSoundClass::SoundSourceClass::~SoundSourceClass() {}
 
-JointSoundClass::JointClass::JointClass(int soundId, float position) : soundId(soundId), position(position) {}
+JointSoundClass::JointClass::JointClass(int soundId, double position) : soundId(soundId), position(position) {}
 JointSoundClass::JointClass::JointClass(const JointClass& obj) : soundId(obj.soundId), position(obj.position) {}
 JointSoundClass::JointClass::~JointClass() {}
 
@@ -20,15 +20,17 @@ JointSoundClass::WheelClass::WheelClass(float position, float pitch, float volum
 JointSoundClass::WheelClass::WheelClass(const WheelClass& obj) : position(obj.position), pitch(obj.pitch), volume(obj.volume) {}
 JointSoundClass::WheelClass::~WheelClass() {}
 
-JointSoundClass::PlayerClass::PlayerClass(JointClass* pJoint, WheelClass* pWheel, SoundSourceClass* pSoundSource, float height, int volume)
-    : _pJoint(pJoint), _pWheel(pWheel), _pSoundSource(pSoundSource), _height(height), _playingSpeed(1.0), _playingPosition(0.0), _isPlaying(false), _isFinished(false), _volume(volume) {
-  for (int i = 0; i < sizeof(_buf); i++) _buf[i] = 0x0;
+JointSoundClass::PlayerClass::PlayerClass(int wheel, int sound, float height, int volume)
+    : _wheel(wheel), _sound(sound), _height(height), _volume(volume), _cursor(0), _playingPosition(0.0), _isPlaying(false), _isFinished(false), _startCount(0) {
+#ifdef USE_FIXED_POINT
+  _playingPositionQ = 0;
+#endif
 }
 JointSoundClass::PlayerClass::PlayerClass(const PlayerClass& obj)
-    : _pJoint(obj._pJoint), _pWheel(obj._pWheel), _pSoundSource(obj._pSoundSource), _height(obj._height), _playingSpeed(obj._playingSpeed), _playingPosition(obj._playingPosition), _isPlaying(obj._isPlaying), _isFinished(obj._isFinished), _volume(obj._volume) {
-  for (int i = 0; i < 4; i++) {
-    _buf[i] = obj._buf[i];
-  }
+    : _wheel(obj._wheel), _sound(obj._sound), _height(obj._height), _volume(obj._volume), _cursor(obj._cursor), _playingPosition(obj._playingPosition), _isPlaying(obj._isPlaying), _isFinished(obj._isFinished), _startCount(obj._startCount) {
+#ifdef USE_FIXED_POINT
+  _playingPositionQ = obj._playingPositionQ;
+#endif
 }
 JointSoundClass::PlayerClass::~PlayerClass() {}
 
@@ -36,61 +38,99 @@ void JointSoundClass::PlayerClass::setPlaying(bool play) { _isPlaying = play; }
 
 bool JointSoundClass::PlayerClass::getIsFinished() { return _isFinished; }
 
-uint8_t* JointSoundClass::PlayerClass::createSample(float speed) {
-  if (_isPlaying && !_isFinished) {
-    // 再生速度(=音の高さ)を計算
-    float speedRatio = speed / _pSoundSource->speed;
-    _playingSpeed = _pSoundSource->interceptPitch + (1 - _pSoundSource->interceptPitch) * speedRatio;  // 音程-速度特性は一次関数を仮定
-    _playingSpeed *= _pWheel->pitch;                                                                   // 車輪固有の特性
+#ifdef USE_FIXED_POINT
+void JointSoundClass::PlayerClass::render(const float* speed, const int end, const WheelClass& rWheel, const SoundSourceClass& rSoundSource, const ResampleKernel /* kernel */, const Resampler& /* rResampler */, int32_t* bus) {
+#else
+void JointSoundClass::PlayerClass::render(const float* speed, const int end, const WheelClass& rWheel, const SoundSourceClass& rSoundSource, const ResampleKernel kernel, const Resampler& rResampler, float* bus) {
+#endif
+  int k = _cursor;
+  _cursor = end;
+  if (!_isPlaying || _isFinished) {
+    return;
+  }
+
+  // 再生速度(=音の高さ)は走行速度の一次関数を仮定し、車輪固有の特性をかける. 再生速度 = pitchIntercept + pitchSlope * 走行速度
+  const float pitchIntercept = rSoundSource.interceptPitch * rWheel.pitch;
+  const float pitchSlope = (1 - rSoundSource.interceptPitch) / rSoundSource.speed * rWheel.pitch;
 
-    // 振幅を計算
-    float amp = _height / sqrtf(_height * _height + _pWheel->position * _pWheel->position);  // 音源からの距離による減衰
-    amp *= _pWheel->volume;                                                                  // 隣の車両にあるなど、車輪固有の減衰
-    amp *= (_volume / 32767.0);
+  // 振幅は車輪の位置と音量だけで決まるので、ブロックごとに1回求める
+  float amp = _height / sqrtf(_height * _height + rWheel.position * rWheel.position);  // 音源からの距離による減衰
+  amp *= rWheel.volume;                                                                 // 隣の車両にあるなど、車輪固有の減衰
+  amp *= (_volume / 32767.0);
 
+  const int16_t* pcm = reinterpret_cast<const int16_t*>(rSoundSource.buf);  // L, R の順に並んだ符号付16bit整数
+  const int frames = rSoundSource.size / 2 / 2;  // ステレオで /2, 2byte/sampleなので /2
+  const int last = frames - 1;  // 線形補間で i1+1 を読むので、i1 はこれ未満. 再生の長さは補間方式によらずこれで決める
+#ifdef USE_FIXED_POINT
+  const int32_t ampQ = static_cast<int32_t>(amp * 32767.0f);  // Q15
+  uint32_t positionQ = _playingPositionQ;
+  for (; k < end; k++) {
+    // 何サンプル目を再生するかに変換(整数部と小数部に分けて持つ)
+    float pitch = pitchIntercept + pitchSlope * speed[k];
+    if (pitch < 0.0f) pitch = 0.0f;  // 音源を逆向きには再生しない(負の値の変換は未定義)
+    positionQ += static_cast<uint32_t>(pitch * (1 << POSITION_FRAC_BITS) + 0.5f);
+    int i1 = static_cast<int>(positionQ >> POSITION_FRAC_BITS);
+    if (i1 >= last) {  // インデックスが長さを越えている場合、再生終了したので停止
+      _isFinished = true;
+      _isPlaying = false;
+      break;
+    }
+    // LとRの2つについて、線形補完してサンプル生成
+    int32_t alpha = positionQ & ((1 << POSITION_FRAC_BITS) - 1);  // 線形補間の位置. 0 は x1 側、(1 << POSITION_FRAC_BITS) は x2 側
+    const int16_t* p = &pcm[2 * i1];
+    bus[2 * k] += ((p[0] * (1 << POSITION_FRAC_BITS) + (p[2] - p[0]) * alpha) >> POSITION_FRAC_BITS) * ampQ >> 15;
+    bus[2 * k + 1] += ((p[1] * (1 << POSITION_FRAC_BITS) + (p[3] - p[1]) * alpha) >> POSITION_FRAC_BITS) * ampQ >> 15;
+  }
+  _playingPositionQ = positionQ;
+#else
+  int16_t edge[2 * Resampler::SINC_TAPS];  // 音源の端で補間に使うフレーム
+  float position = _playingPosition;
+  for (; k < end; k++) {
     // 何サンプル目を再生するかに変換
-    _playingPosition += _playingSpeed;
-    int i1 = static_cast<int>(_playingPosition);
-    int i2 = i1 + 1;
-    // printf("_playingPosition, i1, i2 = %f, %d, %d\n", _playingPosition, i1, i2);
-    // インデックスが長さを越えている場合、再生終了したので停止
-    if (i2 >= _pSoundSource->size / 2 / 2) {  // ステレオで /2, 2byte/sampleなので /2
+    float pitch = pitchIntercept + pitchSlope * speed[k];
+    if (pitch < 0.0f) pitch = 0.0f;  // 音源を逆向きには再生しない(音源の先頭より前を読まないように)
+    position += pitch;
+    int i1 = static_cast<int>(position);
+    if (i1 >= last) {  // インデックスが長さを越えている場合、再生終了したので停止
       _isFinished = true;
       _isPlaying = false;
-      // LとRの2つについて、線形補完してサンプル生成
+      break;
+    }
+    // LとRの2つについて、補間してサンプル生成
+    float alpha = position - static_cast<float>(i1);  // 補間の位置(0～1). 0 は x1 側、1 は x2 側
+    const int16_t* p = &pcm[2 * i1];
+    float l, r;
+    if (kernel == RESAMPLE_LINEAR) {
+      l = p[0] + alpha * (p[2] - p[0]);
+      r = p[1] + alpha * (p[3] - p[1]);
     } else {
-      float alpha = _playingPosition - static_cast<float>(i1);  // 線形補間の位置(0～1). 0 は x1 側、1 は x2 側
-      int16_t sample1, sample2, result;
-      // L
-      sample1 = *(reinterpret_cast<int16_t*>(&_pSoundSource->buf[4 * i1]));  // 4*i1のアドレスをint16_t型とみなして読み込む
-      sample2 = *(reinterpret_cast<int16_t*>(&_pSoundSource->buf[4 * i2]));
-      result = static_cast<int16_t>(amp * ((1 - alpha) * sample1 + alpha * sample2));
-      // printf("L sample1, sample2, result = %d, %d, %d\n", sample1, sample2, result);
-      _buf[0] = result & 0xff;
-      _buf[1] = result >> 8;
-      // R
-      sample1 = *(reinterpret_cast<int16_t*>(&_pSoundSource->buf[4 * i1 + 2]));
-      sample2 = *(reinterpret_cast<int16_t*>(&_pSoundSource->buf[4 * i2 + 2]));
-      result = static_cast<int16_t>(amp * ((1 - alpha) * sample1 + alpha * sample2));
-      _buf[2] = result & 0xff;
-      _buf[3] = result >> 8;
-
-      return _buf;
-    }
-  }
-  _buf[0] = 0;
-  _buf[1] = 0;
-  _buf[2] = 0;
-  _buf[3] = 0;
-  return _buf;
-}
-
-JointSoundClass::JointSoundClass(const float listeningPointHeight, const bool loopback) : _height(listeningPointHeight), _loopback(loopback), _volume(0.0) {}
+      if (i1 < Resampler::EDGE_BEFORE || i1 + Resampler::EDGE_AFTER >= frames) {
+        p = Resampler::gatherEdge(pcm, frames, i1, edge);  // 範囲外のフレームは0とみなす
+      }
+      if (kernel == RESAMPLE_HERMITE) {
+        Resampler::hermite(p, alpha).sumHalves(l, r);
+      } else {
+        rResampler.sinc(p, alpha).sumHalves(l, r);
+      }
+    }
+    bus[2 * k] += amp * l;
+    bus[2 * k + 1] += amp * r;
+  }
+  _playingPosition = position;
+#endif
+}
+
+JointSoundClass::JointSoundClass(const float listeningPointHeight, const bool loopback) : _height(listeningPointHeight), _loopback(loopback), _volume(0.0), _resampler(Resampler::instance()), _resampleKernel(RESAMPLE_LINEAR), _jointHead(0), _jointNum(0), _voiceSteal(JOINT_VOICE_STEAL_OLDEST), _startCount(0), _isCursorValid(false), _odometer(0.0) {
+  setPlayerNum(PLAYER_NUM_DEFAULT);
+}
 JointSoundClass::~JointSoundClass() {
   _soundVector.clear();
-  _jointDeque.clear();
   _wheelVector.clear();
-  _playerVector.clear();
+  _wheelOrder.clear();
+  _jointRing.clear();
+  _playerPool.clear();
+  _activePlayer.clear();
+  _freePlayer.clear();
 }
 
 int JointSoundClass::addSoundSource(int id, float speed, float minSpeed, float interceptPitch, float interceptVolume, uint8_t* buf, int size) {
@@ -100,9 +140,18 @@ int JointSoundClass::addSoundSource(int id, float speed, float minSpeed, float i
 
 int JointSoundClass::addJoint(int soundId, float position) {
   for (auto& x : _soundVector) {
-    if (x.id == soundId) {                                   // soundIdで指定されたidをもつ音源データが存在するか確認
-      _jointDeque.push_back(JointClass(soundId, position));  // 新規作成
-      std::sort(_jointDeque.begin(), _jointDeque.end(), [](const JointClass& lhs, const JointClass& rhs) { return lhs.position < rhs.position; });  // positionの小さい順に並べ替え
+    if (x.id == soundId) {  // soundIdで指定されたidをもつ音源データが存在するか確認
+      reserveJoints(_jointNum + 1);
+      // 新規作成. 線路上の座標に直して持つ. positionの小さい順になるよう、後方から挿入位置を探す
+      JointClass newJoint(soundId, position - _odometer);
+      size_t i = _jointNum;
+      while (i > 0 && joint(i - 1).position > newJoint.position) {
+        joint(i) = joint(i - 1);
+        i--;
+      }
+      joint(i) = newJoint;
+      _jointNum++;
+      _isCursorValid = false;
       return 1;
     }
   }
@@ -112,8 +161,12 @@ int JointSoundClass::addJoint(int soundId, float position) {
 int JointSoundClass::addForwardJoint(int soundId, float position) {
   for (auto& x : _soundVector) {
     if (x.id == soundId) {                                      // soundIdで指定されたidをもつ音源データが存在するか確認
-      if (position < _jointDeque.front().position) {            // 指定された位置が最前方であるか確認
-        _jointDeque.push_front(JointClass(soundId, position));  // 先頭に挿入
+      if (_jointNum == 0 || position - _odometer < joint(0).position) {  // 指定された位置が最前方であるか確認
+        reserveJoints(_jointNum + 1);
+        _jointHead = (_jointHead - 1) & (_jointRing.size() - 1);  // 先頭に挿入
+        joint(0) = JointClass(soundId, position - _odometer);
+        _jointNum++;
+        _isCursorValid = false;
         return 1;
       }
     }
@@ -122,8 +175,11 @@ int JointSoundClass::addForwardJoint(int soundId, float position) {
 }
 
 int JointSoundClass::addWheel(float position, float pitch, float volume) {
-  _wheelVector.push_back(WheelClass(position, pitch, volume));                                                                                    // 新規作成
-  std::sort(_wheelVector.begin(), _wheelVector.end(), [](const WheelClass& lhs, const WheelClass& rhs) { return lhs.position < rhs.position; });  // positionの小さい順に並べ替え
+  _wheelVector.push_back(WheelClass(position, pitch, volume));  // 新規作成. 再生中の音が番号で参照するので、_wheelVector 自体は並べ替えない
+  _wheelOrder.push_back(static_cast<int>(_wheelVector.size()) - 1);
+  std::stable_sort(_wheelOrder.begin(), _wheelOrder.end(), [this](int lhs, int rhs) { return _wheelVector[lhs].position < _wheelVector[rhs].position; });  // positionの小さい順に並べ替え
+  _eventVector.reserve(2 * _wheelVector.size());  // 1ブロックの間に各wheelが跨ぐjointはふつう1つまで. 音声生成中に確保し直さないよう余裕をもたせる
+  _isCursorValid = false;
   return 1;
 }
 
@@ -135,79 +191,285 @@ int JointSoundClass::setVolume(int volume) {
   return 1;
 }
 
+int JointSoundClass::setPlayerNum(int num) {
+  if (num < 1) {
+    return 0;
+  }
+  _playerPool.assign(num, PlayerClass(0, 0, _height, 0));
+  _activePlayer.clear();
+  _activePlayer.reserve(num);
+  _freePlayer.clear();
+  _freePlayer.reserve(num);
+  for (int i = num - 1; i >= 0; i--) {
+    _freePlayer.push_back(i);  // 番号の小さいものから使う
+  }
+  return 1;
+}
+
+int JointSoundClass::setResampleKernel(ResampleKernel kernel) {
+  if (kernel < 0 || kernel >= RESAMPLE_KERNEL_NUM) {
+    return 0;
+  }
+#ifdef USE_FIXED_POINT
+  if (kernel != RESAMPLE_LINEAR) {
+    return 0;  // 固定小数点版は線形補間のみ
+  }
+#endif
+  _resampleKernel = kernel;
+  return 1;
+}
+
+int JointSoundClass::setVoiceSteal(JointVoiceSteal steal) {
+  if (steal < 0 || steal >= JOINT_VOICE_STEAL_NUM) {
+    return 0;
+  }
+  _voiceSteal = steal;
+  return 1;
+}
+
 int JointSoundClass::generateSound(uint8_t* buf, int size, float* speed) {
   // エラーチェック
-  if (_soundVector.empty() || _jointDeque.empty() || _wheelVector.empty()) {
+  if (_soundVector.empty() || _jointNum == 0 || _wheelVector.empty()) {
     return 0;  // sound, joint, wheel それぞれ1つ以上あるか確認
   }
-  if (_loopback && _jointDeque.size() < 2) {
+  if (_loopback && _jointNum < 2) {
     return 0;  // loopback==trueのときはjoint数2つ以上が必要
   }
 
-  // 必要なサンプル数ぶんの計算を行う
-  for (int s_i = 0; s_i < size / 4; s_i++) {  // s_i : sample index のつもり
-    // printf("sample %d\n", s_i);
+  // 必要なサンプル数ぶんの計算を CROSSING_BLOCK サンプルずつ行う
+  for (int base = 0; base < size / 4; base += CROSSING_BLOCK) {
+    const int num = (size / 4 - base < CROSSING_BLOCK) ? size / 4 - base : CROSSING_BLOCK;
 
     // -- joint通過判定 --
-    // jointの位置を進める
-    float traveledDistance = speed[s_i] / 3.6 * T_SAMPLE;  // サンプリング時間の間に進んだ距離[m]
-    for (auto& rJoint : _jointDeque) {
-      rJoint.position += traveledDistance;  // jointの位置を進める
-      // printf("joint pos = %f\n", rJoint.position);
-    }
-
-    // それぞれのwheelについて、jointを跨いだかどうか判定する
-    for (auto& rWheel : _wheelVector) {
-      for (auto& rJoint : _jointDeque) {
-        if ((rJoint.position - traveledDistance) < rWheel.position && rWheel.position < rJoint.position) {
-          // printf("joint passed\n");
-          for (auto& rSoundSource : _soundVector) {  // このジョイントに紐づけられた音源への参照を取得
-            if (rSoundSource.id == rJoint.soundId) {
-              // playerを生成し、再生を開始
-              // printf("created player\n");
-              _playerVector.push_back(PlayerClass(&rJoint, &rWheel, &rSoundSource, _height, _volume));
-              _playerVector.back().setPlaying(1);
-            }
+    // 各サンプルまでの走行距離を求め、各wheelが次のjointを跨ぐサンプルをまとめて求める. jointの位置は動かさない
+    // 負の速度は0とみなす. 走行距離と再生速度の両方にこの値を用いる
+    for (int k = 0; k < num; k++) {
+      float v = (speed[base + k] > 0.0) ? speed[base + k] : 0.0;
+      _blockSpeed[k] = v;
+      _step[k] = v / 3.6 * T_SAMPLE;  // サンプリング時間の間に進んだ距離[m]
+      _odometer += _step[k];
+      _odometerAt[k] = _odometer;
+    }
+    detectCrossings(num);
+
+    // -- このブロックでjointを跨いだwheelについて、playerを生成し、通過したサンプルから再生を開始 --
+    const float* blockSpeed = _blockSpeed;
+    for (int k = 0; k < 2 * num; k++) {
+      _bus[k] = 0;
+    }
+    for (int i : _activePlayer) {
+      _playerPool[i]._cursor = 0;  // 前のブロックから続くplayerはブロックの先頭から生成する
+    }
+    for (const CrossingEvent& rEvent : _eventVector) {
+      for (size_t sound = 0; sound < _soundVector.size(); sound++) {  // このジョイントに紐づけられた音源を探す
+        if (_soundVector[sound].id == rEvent.soundId) {
+          PlayerClass* pPlayer = acquirePlayer(blockSpeed, rEvent.sample);
+          if (pPlayer == nullptr) {
+            continue;  // 空きがなく、JOINT_VOICE_STEAL_NONE のため鳴らさない
           }
+          *pPlayer = PlayerClass(rEvent.wheel, static_cast<int>(sound), _height, _volume);
+          pPlayer->_cursor = rEvent.sample;
+          pPlayer->_startCount = _startCount++;
+          pPlayer->setPlaying(1);
         }
       }
     }
 
-    // -- 進行方向最後方(position最大)のジョイントについて、すべてのwheelを通り過ぎていたら位置を更新 --
-    // 最後方のジョイントがすべてのwheelを通過済みの場合
-    if (_jointDeque.back().position > _wheelVector.back().position) {
-      // ループバック有効時、最後方のジョイントを最前方へ戻す
-      if (_loopback) {
-        float frontPosition = _jointDeque.front().position;         // 最前方のジョイントの位置を取得
-        float backPosition = _jointDeque.back().position;           // 最後方のジョイントの位置を取得
-        float back2Position = (*(_jointDeque.end() - 2)).position;  // 最後方から2番目のジョイントの位置を取得
-
-        _jointDeque.push_front(JointClass(_jointDeque.back()));                         // 最後方のジョイントを最前方へコピー
-        _jointDeque.front().position = frontPosition - (backPosition - back2Position);  // 位置を設定
+    // -- 各playerについてブロックの残りを生成し、bufへ出力 --
+    renderPlayers(blockSpeed, num);
+    int16_t* pcm = reinterpret_cast<int16_t*>(&buf[4 * base]);
+    for (int k = 0; k < 2 * num; k++) {
+      int v = pcm[k] + static_cast<int>(_bus[k]);
+      if (v > 32767) v = 32767;
+      if (v < -32767) v = -32767;
+      pcm[k] = static_cast<int16_t>(v);
+    }
+  }
+  return 1;
+}
+
+/// @brief 再生中のすべてのプレイヤーについて、ブロック内のサンプル end の直前までを _bus に生成する. 再生終了したプレイヤーは空きに戻す
+/// @param[in] speed ブロック内の各サンプルにおける走行速度 [km/h]
+/// @param[in] end 生成を終えるサンプル番号(これ自身は含まない)
+void JointSoundClass::renderPlayers(const float* speed, const int end) {
+  size_t i = 0;
+  while (i < _activePlayer.size()) {
+    PlayerClass& rPlayer = _playerPool[_activePlayer[i]];
+    rPlayer.render(speed, end, _wheelVector[rPlayer._wheel], _soundVector[rPlayer._sound], _resampleKernel, _resampler, _bus);
+    if (rPlayer._isFinished) {
+      // 末尾のplayerを空いた場所に移す. 移したplayerはまだ生成していないので、i は進めない
+      _freePlayer.push_back(_activePlayer[i]);
+      _activePlayer[i] = _activePlayer.back();
+      _activePlayer.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+/// @brief 空いているプレイヤーを1つ取り出して再生中にする. 空きがない場合は、それまでのサンプルを生成して再生終了したものを空きに戻し、
+///        それでもない場合は _voiceSteal に従って再生中のものを横取りする
+/// @param[in] speed ブロック内の各サンプルにおける走行速度 [km/h]
+/// @param[in] sample 再生を始めるブロック内のサンプル番号
+/// @retval 使ってよいプレイヤーへのポインタ. 鳴らさない場合は nullptr
+JointSoundClass::PlayerClass* JointSoundClass::acquirePlayer(const float* speed, const int sample) {
+  if (_freePlayer.empty()) {
+    renderPlayers(speed, sample);
+  }
+  if (!_freePlayer.empty()) {
+    int index = _freePlayer.back();
+    _freePlayer.pop_back();
+    _activePlayer.push_back(index);  // setPlayerNum() で確保済みなので再確保は起きない
+    return &_playerPool[index];
+  }
+  if (_voiceSteal == JOINT_VOICE_STEAL_NONE || _activePlayer.empty()) {
+    return nullptr;
+  }
+
+  int victim = _activePlayer[0];
+  if (_voiceSteal == JOINT_VOICE_STEAL_OLDEST) {
+    for (int index : _activePlayer) {
+      if (_startCount - _playerPool[index]._startCount > _startCount - _playerPool[victim]._startCount) {  // 開始からの経過数で比べる(桁あふれしても正しい)
+        victim = index;
+      }
+    }
+  } else {
+    // 聴取点での振幅は volume * height / sqrt(height^2 + position^2) なので、その2乗を height^2 を除いて比べる
+    float minAmp2 = -1.0;
+    for (int index : _activePlayer) {
+      const WheelClass& rWheel = _wheelVector[_playerPool[index]._wheel];
+      float amp2 = rWheel.volume * rWheel.volume / (_height * _height + rWheel.position * rWheel.position);
+      if (minAmp2 < 0.0 || amp2 < minAmp2) {
+        minAmp2 = amp2;
+        victim = index;
       }
-      // 削除
-      _jointDeque.pop_back();
     }
+  }
+  return &_playerPool[victim];
+}
+
+/// @brief ジョイントのリングバッファを num 個以上入る長さにする. 足りない場合のみ確保し直し、最前方を先頭に詰め直す
+/// @param[in] num 必要なジョイントの数
+void JointSoundClass::reserveJoints(const size_t num) {
+  if (num <= _jointRing.size()) {
+    return;
+  }
+  size_t capacity = 16;
+  while (capacity < num) {
+    capacity *= 2;
+  }
+  std::vector<JointClass> ring(capacity, JointClass(0, 0.0));
+  for (size_t i = 0; i < _jointNum; i++) {
+    ring[i] = joint(i);
+  }
+  _jointRing.swap(ring);
+  _jointHead = 0;
+}
 
-    // -- 各playerについてサンプル生成し、bufへ出力 --
-    int16_t* oneBufL = reinterpret_cast<int16_t*>(&buf[4 * s_i]);
-    int16_t* oneBufR = reinterpret_cast<int16_t*>(&buf[4 * s_i + 2]);
-    for (auto& rPlayer : _playerVector) {
-      uint8_t* sample = rPlayer.createSample(speed[s_i]);
-      *oneBufL += *(reinterpret_cast<int16_t*>(&sample[0]));
-      *oneBufR += *(reinterpret_cast<int16_t*>(&sample[2]));
+/// @brief 各wheelの次に跨ぐjoint(_wheelCursor)を求め直す
+/// @param[in] odometer 比較する時点での走行距離[m]
+void JointSoundClass::updateCursors(const double odometer) {
+  _wheelCursor.resize(_wheelVector.size());
+  int c = -1;
+  for (size_t i = 0; i < _wheelOrder.size(); i++) {  // positionの小さいwheelから
+    while (c + 1 < static_cast<int>(_jointNum) && joint(c + 1).position + odometer < _wheelVector[_wheelOrder[i]].position) {
+      c++;
     }
+    _wheelCursor[i] = c;
+  }
+  _isCursorValid = true;
+}
 
-    // -- 再生終了したplayerは破棄 --
-    auto itr = _playerVector.begin();
-    while (itr != _playerVector.end()) {
-      if ((*itr)._isFinished) {
-        _playerVector.erase(itr);
-        // printf("deleted player\n");
-      } else {
-        ++itr;
+/// @brief 線路上の位置が position のjointが、聴取点からみて threshold を初めて越えるサンプルを二分探索で求める.
+///        _odometerAt は単調非減少なので、position + _odometerAt[k] > threshold は k について単調
+/// @param[in] position 線路上の座標でのjointの位置[m]
+/// @param[in] threshold 越えるかどうかを調べる、聴取点からみた位置[m]
+/// @param[in] begin 探索範囲の先頭のサンプル番号
+/// @param[in] end 探索範囲の終端のサンプル番号(これ自身は含まない)
+/// @retval 越えるサンプル番号. 範囲内で越えない場合は end
+int JointSoundClass::findCrossingSample(const double position, const float threshold, int begin, int end) const {
+  while (begin < end) {
+    int mid = (begin + end) / 2;
+    if (position + _odometerAt[mid] > threshold) {
+      end = mid;
+    } else {
+      begin = mid + 1;
+    }
+  }
+  return begin;
+}
+
+/// @brief ブロック内のjoint通過を求めて _eventVector にサンプル番号順に入れる.
+///        wheelごとに次に跨ぐjointだけを調べるので、計算量はwheel数と通過の回数で決まり、joint数にはよらない.
+///        最後方のjointがすべてのwheelを通過したサンプルでは、そこでjointの並びを更新してから残りを調べる
+/// @param[in] num ブロックのサンプル数. _odometerAt, _step を num 個ぶん求めておくこと
+void JointSoundClass::detectCrossings(const int num) {
+  _eventVector.clear();
+  if (!_isCursorValid) {
+    updateCursors(_odometerAt[0] - _step[0]);  // ブロックの直前の時点
+  }
+
+  int begin = 0;
+  while (begin < num && _jointNum > 0) {
+    // 最後方(position最大)のjointがすべてのwheelを通り過ぎるサンプルまでを区間とする
+    int retire = findCrossingSample(joint(_jointNum - 1).position, _wheelVector[_wheelOrder.back()].position, begin, num);
+    int end = (retire < num) ? retire + 1 : num;
+
+    // それぞれのwheelについて、次のjointから順に区間内で跨ぐかどうか判定する
+    for (size_t i = 0; i < _wheelOrder.size(); i++) {
+      const WheelClass& rWheel = _wheelVector[_wheelOrder[i]];
+      int c = _wheelCursor[i];
+      while (c >= 0) {
+        const JointClass& rJoint = joint(c);
+        int k = findCrossingSample(rJoint.position, rWheel.position, begin, end);
+        if (k >= end) {
+          break;
+        }
+        if ((rJoint.position + _odometerAt[k]) - _step[k] < rWheel.position) {  // ちょうど同じ位置にあった場合は跨いだとみなさない
+          _eventVector.push_back(CrossingEvent{k, rJoint.soundId, _wheelOrder[i]});
+        }
+        c--;
       }
+      _wheelCursor[i] = c;
+    }
+    if (retire >= num) {
+      break;
     }
+
+    // -- 進行方向最後方(position最大)のジョイントについて、すべてのwheelを通り過ぎていたら位置を更新 --
+    // ループバック有効時、最後方のジョイントを最前方へ戻す. 線路上の座標なので、走行距離によらず間隔だけで位置が決まる
+    // リングバッファの先頭を1つ戻して最後方のジョイントを書き込むので、要素の移動もメモリの確保も起きない
+    if (_loopback) {
+      double frontPosition = joint(0).position;              // 最前方のジョイントの位置を取得
+      double backPosition = joint(_jointNum - 1).position;   // 最後方のジョイントの位置を取得
+      double back2Position = joint(_jointNum - 2).position;  // 最後方から2番目のジョイントの位置を取得
+
+      JointClass back = joint(_jointNum - 1);
+      _jointHead = (_jointHead - 1) & (_jointRing.size() - 1);  // 最後方のジョイントを最前方へ移す
+      joint(0) = back;
+      joint(0).position = frontPosition - (backPosition - back2Position);  // 位置を設定
+
+      // 既存のジョイントの番号は1つずつ後ろへずれる. 新しい最前方のジョイントをまだ跨いでいないwheelは、それより後ろのジョイントもすべて跨いでいない
+      const double newFront = joint(0).position + _odometerAt[retire];
+      for (size_t i = 0; i < _wheelOrder.size(); i++) {
+        _wheelCursor[i] = (newFront < _wheelVector[_wheelOrder[i]].position) ? _wheelCursor[i] + 1 : -1;
+      }
+    } else {
+      // 削除. 最後方のジョイントはすべてのwheelが跨ぎ終えているので、_wheelCursor は変わらない
+      _jointNum--;
+    }
+    begin = end;
+  }
+
+  // wheel順に求めた通過をサンプル順に並べ替える. 同じサンプルではwheel順のまま.
+  // 通過はブロックあたり数個なので挿入ソートで足りる(std::stable_sort は作業領域をヒープに確保するので使わない)
+  for (size_t i = 1; i < _eventVector.size(); i++) {
+    CrossingEvent event = _eventVector[i];
+    size_t j = i;
+    while (j > 0 && _eventVector[j - 1].sample > event.sample) {
+      _eventVector[j] = _eventVector[j - 1];
+      j--;
+    }
+    _eventVector[j] = event;
   }
-  return 1;
 }
@@ -1,10 +1,18 @@
 #pragma once
 
 #include <algorithm>
-#include <deque>
 #include <vector>
 
 #include "constant.h"
+#include "Resampler.h"
+
+/// @brief プレイヤーがすべて使用中のときに、新しいジョイント通過音をどう扱うか
+typedef enum JointVoiceSteal {
+  JOINT_VOICE_STEAL_NONE,      // 新しい音を鳴らさない
+  JOINT_VOICE_STEAL_OLDEST,    // 最も早く鳴り始めた音を止めて、新しい音に使う
+  JOINT_VOICE_STEAL_QUIETEST,  // 聴取点で最も小さく聞こえる音(車輪が遠いもの)を止めて、新しい音に使う
+  JOINT_VOICE_STEAL_NUM
+} JointVoiceSteal;
 
 class JointSoundClass {
  private:
@@ -25,12 +33,13 @@ class JointSoundClass {
 
   class JointClass {
    public:
-    JointClass(int soundId, float position);
+    JointClass(int soundId, double position);
     JointClass(const JointClass& obj);
+    JointClass& operator=(const JointClass& obj) = default;  // リングバッファ上で上書きするのに使う
     ~JointClass();
 
     int soundId;
-    float position;
+    double position;  // 線路上に固定した座標系でのジョイント位置[m]. 聴取点からみた位置は position + _odometer
   };
 
   class WheelClass {
@@ -46,14 +55,15 @@ class JointSoundClass {
 
   class PlayerClass {
    public:
-    /// @brief ジョイントと車輪の組み合わせによって生じる音を計算し、再生用のPCMデータを生成するクラス
-    /// @param pJoint 音源になるジョイントを指すポインタ
-    /// @param pWheel 音源になる車輪を指すポインタ
-    /// @param pSoundSource 再生する音源を指すポインタ
+    /// @brief ジョイントと車輪の組み合わせによって生じる音を計算し、再生用のPCMデータを生成するクラス.
+    ///        車輪と音源はポインタではなく _wheelVector, _soundVector 上の番号で持つ(どちらも追加のみで並べ替えないので、番号は変わらない)
+    /// @param wheel 音源になる車輪の _wheelVector 上の番号
+    /// @param sound 再生する音源の _soundVector 上の番号
     /// @param height 音源(レール上面を仮定)から聴取点までの距離 [m]
     /// @param volume 再生音量(0-32767)
-    PlayerClass(JointClass* pJoint, WheelClass* pWheel, SoundSourceClass* pSoundSource, float height, int volume);
+    PlayerClass(int wheel, int sound, float height, int volume);
     PlayerClass(const PlayerClass& obj);
+    PlayerClass& operator=(const PlayerClass& obj) = default;  // プールのプレイヤーを再生開始時に上書きするのに使う
 
     ~PlayerClass();
 
@@ -65,33 +75,95 @@ class JointSoundClass {
     /// @retval 1 : 再生終了済, 0 : 未完了
     bool getIsFinished(void);
 
-    /// @brief 速度に応じて、ひとつのサンプルを生成
-    /// @param speed 現在の走行速度 [km/h]
-    /// @retval 16-bit stereo PCM 形式のデータ. 符号付16bit整数で、先頭16bitが L, 後方16bitが R.
-    uint8_t* createSample(float speed);
-
-    JointClass* _pJoint;              // 生成対象のジョイント
-    WheelClass* _pWheel;              // 生成対象の車輪
-    SoundSourceClass* _pSoundSource;  // 再生する音源
-    float _height;                    // 音源(レール上面を仮定)から聴取点までの距離 [m]
+    /// @brief ブロック内のサンプル _cursor から end の直前までを生成し、ミックスバスに足し込む.
+    ///        振幅と、再生速度を走行速度の一次式にする係数は呼び出しごとに1回だけ求めるので、1サンプルあたりは積和と補間だけになる
+    /// @param speed ブロック内の各サンプルにおける走行速度 [km/h]
+    /// @param end 生成を終えるサンプル番号(これ自身は含まない)
+    /// @param rWheel 生成対象の車輪(_wheelVector[_wheel])
+    /// @param rSoundSource 再生する音源(_soundVector[_sound])
+    /// @param kernel 補間方式. USE_FIXED_POINT 定義時は RESAMPLE_LINEAR のみ
+    /// @param rResampler 補間のテーブル
+    /// @param bus ブロックのミックスバス. L, R の順に並べる
+#ifdef USE_FIXED_POINT
+    void render(const float* speed, const int end, const WheelClass& rWheel, const SoundSourceClass& rSoundSource, const ResampleKernel kernel, const Resampler& rResampler, int32_t* bus);
+#else
+    void render(const float* speed, const int end, const WheelClass& rWheel, const SoundSourceClass& rSoundSource, const ResampleKernel kernel, const Resampler& rResampler, float* bus);
+#endif
+
+    int _wheel;     // 生成対象の車輪の _wheelVector 上の番号
+    int _sound;     // 再生する音源の _soundVector 上の番号
+    float _height;  // 音源(レール上面を仮定)から聴取点までの距離 [m]
     int _volume;  // 音量(0-32767)
+    int _cursor;    // ブロック内で次に生成するサンプル番号
 
-    uint8_t _buf[4];  // 1サンプルぶんのPCMデータを保存するバッファ. 符号付16bit整数で、先頭16bitが L, 後方16bitが R.
-
-    float _playingSpeed;     // 再生速度は元の音源の何倍であるか
     float _playingPosition;  // 音源の再生位置[サンプル目]
+#ifdef USE_FIXED_POINT
+    static const int POSITION_FRAC_BITS = 12;  // _playingPositionQ の小数部のビット数
+    uint32_t _playingPositionQ;  // 音源の再生位置[サンプル目]. 下位 POSITION_FRAC_BITS ビットが小数部
+#endif
     bool _isPlaying;         // 現在再生中か？
     bool _isFinished;        // 最後まで再生したか？
+    uint32_t _startCount;    // 再生を開始した順番. JOINT_VOICE_STEAL_OLDEST で使う
   };
 
+  /// @brief 車輪がジョイントを通過する事象. 通過したサンプルで PlayerClass を生成する
+  struct CrossingEvent {
+    int sample;   // ブロック内のサンプル番号
+    int soundId;  // 通過したジョイントの音源ID. ジョイントはブロック内で削除されることがあるので控えておく
+    int wheel;    // 通過した車輪の _wheelVector 上の番号
+  };
+
+  static const int CROSSING_BLOCK = 256;  // ジョイント通過をまとめて求めるサンプル数
+  static const int PLAYER_NUM_DEFAULT = 32;  // 同時に鳴らせる音の数の既定値
+
   const float _height;   // distance from sound source to listening point [m]
   const bool _loopback;  // joint loopback enable flag
   int _volume;  // 音量(0-32767);
-
-  std::vector<SoundSourceClass> _soundVector;
-  std::deque<JointClass> _jointDeque;
-  std::vector<WheelClass> _wheelVector;
-  std::vector<PlayerClass> _playerVector;
+  const Resampler& _resampler;    // 音源の補間(共有のテーブル)
+  ResampleKernel _resampleKernel;  // 音源の補間方式
+
+  std::vector<SoundSourceClass> _soundVector;  // 追加した順. 番号はプレイヤーから参照される
+  std::vector<WheelClass> _wheelVector;        // 追加した順. 番号はプレイヤーから参照される
+  std::vector<int> _wheelOrder;                // 車輪の _wheelVector 上の番号を position の小さい順に並べたもの
+
+  // ジョイントはリングバッファに position の小さい順(前方から)に持つ. ループバックでは先頭と末尾を動かすだけで、要素を移動しない
+  std::vector<JointClass> _jointRing;  // リングバッファの実体. 長さは2のべき乗
+  size_t _jointHead;                   // 最前方のジョイントの _jointRing 上の位置
+  size_t _jointNum;                    // ジョイントの数
+
+  /// @brief 前方から i 番目のジョイントを取得する
+  /// @param[in] i 0 が最前方, _jointNum-1 が最後方
+  inline JointClass& joint(const size_t i) { return _jointRing[(_jointHead + i) & (_jointRing.size() - 1)]; }
+  void reserveJoints(const size_t num);
+
+  // プレイヤーは setPlayerNum() でまとめて確保し、音声生成中はヒープを使わずに使い回す
+  std::vector<PlayerClass> _playerPool;  // プレイヤーの実体
+  std::vector<int> _activePlayer;        // 再生中のプレイヤーの _playerPool 上の番号. 順序は問わない
+  std::vector<int> _freePlayer;          // 空いているプレイヤーの _playerPool 上の番号(スタック)
+  JointVoiceSteal _voiceSteal;           // プレイヤーがすべて使用中のときの扱い
+  uint32_t _startCount;                  // これまでに再生を開始した数
+
+#ifdef USE_FIXED_POINT
+  int32_t _bus[2 * CROSSING_BLOCK];  // ブロックのミックスバス(L, R の順). 各プレイヤーの出力を足し合わせてからPCMにする
+#else
+  float _bus[2 * CROSSING_BLOCK];    // ブロックのミックスバス(L, R の順). 各プレイヤーの出力を足し合わせてからPCMにする
+#endif
+
+  PlayerClass* acquirePlayer(const float* speed, const int sample);
+  void renderPlayers(const float* speed, const int end);
+
+  // ジョイント通過の検出用
+  std::vector<int> _wheelCursor;  // _wheelOrder の順の車輪ごとの、次に通過するジョイント(位置が車輪より小さいもののうち最大)の前方からの番号. -1はなし
+  bool _isCursorValid;  // _wheelCursor が現在のジョイント・車輪の配置に対応しているか
+  std::vector<CrossingEvent> _eventVector;  // ブロック内のジョイント通過. サンプル番号順
+  double _odometer;  // 生成済みの最後のサンプルまでの走行距離[m]. 列車を進めるときはこれだけを更新する
+  double _odometerAt[CROSSING_BLOCK];  // ブロック内の各サンプルまでの走行距離[m]
+  double _step[CROSSING_BLOCK];        // 各サンプルで進んだ距離[m]
+  float _blockSpeed[CROSSING_BLOCK];   // ブロック内の各サンプルの走行速度[km/h]. 負の値は0にしてある
+
+  void updateCursors(const double odometer);
+  int findCrossingSample(const double position, const float threshold, int begin, int end) const;
+  void detectCrossings(const int num);
 
  public:
   JointSoundClass(const float listenigPointHeight, const bool loopback);
@@ -116,13 +188,15 @@ class JointSoundClass {
   int addJoint(int soundId, float position);
 
   /// @brief 音声生成中、ジョイントを最も前方(positionが最も負の方向)に動的に追加する
-  ///        高速に処理できるが、追加位置は指定できず最前方のみとなる. 最前方でないジョイント位置を指定した場合エラーとなり、追加されない
+  ///        高速に処理できるが、追加位置は指定できず最前方のみとなる. 最前方でないジョイント位置を指定した場合エラーとなり、追加されない.
+  ///        ジョイントの数がこれまでの最大を超える場合のみメモリを確保し直す
   /// @param soundId  ID of the sound source which is played when a wheel is passing.
   /// @param position joint position when looking from listener.
   /// @retval 1: success, 0: fail
   int addForwardJoint(int soundId, float position);
 
-  /// @brief 初期設定時に車輪を追加する. 音声生成中に実行してはならない
+  /// @brief 初期設定時に車輪を追加する. 音声生成中に実行してはならない.
+  ///        再生中の音は車輪を番号で参照しているので、generateSound() の合間であれば追加してもよい
   /// @param position 聴取点からみた車輪位置[m]. 進行方向前方にある場合は負, 後方にある場合は正.
   /// @param pitch    [省略可] 音程を変える場合に設定. 周波数を何倍するか.
   /// @param volume   [省略可] 音量を変える場合に設定. 振幅を何倍するか.
@@ -133,7 +207,29 @@ class JointSoundClass {
   /// @retval 1:success, 0:fail
   int setVolume(int volume);
 
-  /// @brief ある速度における音データをsize[bytes]ぶん生成する
+  /// @brief 同時に鳴らせる音(プレイヤー)の数を設定し、そのぶんのメモリを確保する. 既定値は PLAYER_NUM_DEFAULT.
+  ///        再生中の音はすべて止まる. 音声生成中に実行してはならない
+  /// @param[in] num 同時に鳴らせる音の数(1以上)
+  /// @retval 1:success, 0:fail
+  int setPlayerNum(int num);
+
+  /// @brief 音源を再生速度に合わせて補間する方式を設定する. 既定値は RESAMPLE_LINEAR.
+  ///        RESAMPLE_HERMITE は線形補間より少し重い程度で補間誤差による雑音を大きく減らせる. RESAMPLE_SINC はさらに折り返しが小さいが、計算量は2倍程度になる.
+  ///        USE_FIXED_POINT 定義時は RESAMPLE_LINEAR のみ設定できる
+  /// @param[in] kernel 補間方式
+  /// @retval 1:success, 0:fail
+  int setResampleKernel(ResampleKernel kernel);
+
+  /// @brief プレイヤーがすべて使用中のときに、新しいジョイント通過音をどう扱うかを設定する. 既定値は JOINT_VOICE_STEAL_OLDEST
+  /// @param[in] steal 扱い方
+  /// @retval 1:success, 0:fail
+  int setVoiceSteal(JointVoiceSteal steal);
+
+  /// @brief ある速度における音データをsize[bytes]ぶん生成し、buf に足し込む.
+  ///        ジョイントの通過は CROSSING_BLOCK サンプルごとに、車輪ごとの次のジョイントについてだけ通過するサンプルを二分探索で求める.
+  ///        各プレイヤーはブロック単位でミックスバスに生成し、最後にまとめてPCMに変換する(int16の範囲に収める).
+  ///        走行速度は0以上を仮定する(負の値は0とみなす).
+  ///        プレイヤーは確保済みのものを使い回すので、この関数はヒープを確保・解放しない(I2Sのコールバックから呼んでもよい)
   /// @param buf  buffer to be filled with PCM data stream
   /// @param size size(in bytes) of data block to be copied to buf. -1 is an indication to user that data buffer shall be flushed
   /// @param speed an array of speed recorded at each sample point. array length must be (size/4).
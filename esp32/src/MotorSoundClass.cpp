@@ -1,12 +1,20 @@
 #include "MotorSoundClass.h"
 
-#include "Filter.h"
-
 #ifndef ARDUINO_ARCH_ESP32
 #include <math.h>
 #endif
 
+#ifdef USE_FIXED_POINT
+MotorSoundClass::MotorSoundClass(const CarDataClass& carData) : _carData(carData), _sineTable(SineTable::instance()) {
+#else
 MotorSoundClass::MotorSoundClass(const CarDataClass& carData) : _carData(carData) {
+#endif
+  _firstHPF.setTau(1.0/300.0);
+  _firstLPF.setTau(1.0/2000.0);
+#ifdef USE_FIXED_POINT
+  _firstHPFQ.setTau(1.0f/300.0f, T_SAMPLE_F);
+  _firstLPFQ.setTau(1.0f/2000.0f, T_SAMPLE_F);
+#endif
   clear();
 }
 
@@ -14,9 +22,18 @@ MotorSoundClass::~MotorSoundClass() {
 }
 
 void MotorSoundClass::clear() {
-  _phaseLargeGear = 0.0;
-  _phaseSmallGear = 0.0;
-  _phaseEngage = 0.0;
+  for (size_t m = 0; m < CarDataClass::CARDATA_MAX_MOTOR_SET_NUM; m++) {
+    _osc[m].reset();
+  }
+#ifdef USE_FIXED_POINT
+  for (int src = 0; src < MOTOR_SOUND_SOURCE_NUM; src++) {
+    _phaseQ[src] = 0;
+  }
+  _firstHPFQ.clear(0);
+  _firstLPFQ.clear(0);
+#endif
+  _firstHPF.clear(0.0);
+  _firstLPF.clear(0.0);
   _volume = 0;
   _isEngagementPlay = false;
 }
@@ -35,79 +52,126 @@ int MotorSoundClass::setEngagementPlay(bool isPlay) {
 }
 
 int MotorSoundClass::generateSound(uint8_t* buf, int size, float* speed) {
+#ifdef USE_FIXED_POINT
+  return generateSoundFixed(buf, size, speed);
+#endif
+  // 走行速度[km/h]から小歯車の回転数[Hz]への換算係数. v=rω=2πrfよりf=v/2πr=v/πΦ
+  const float coeffSpdToRps = 1.0/3.6 / (PI*_carData._wheelDiameter) * (_carData._largeGear/_carData._smallGear);
+
+  // 高調波セットごとの、小歯車の回転数から発振器の基本波の周波数への倍率
+  const size_t setNum = _carData._motorSetNum;
+  float oscRatio[CarDataClass::CARDATA_MAX_MOTOR_SET_NUM];
+  float sourceRatio[CarDataClass::CARDATA_MAX_MOTOR_SET_NUM];
+  for (size_t m = 0; m < setNum; m++) {
+    sourceRatio[m] = (_carData._listMotorSource[m] == MOTOR_SOUND_MESH) ? _carData._smallGear : 1;
+    oscRatio[m] = sourceRatio[m] * _carData._listMotorBaseOrder[m];
+  }
+
+  float rpsSmallGear[MOTOR_BLOCK];
+  float step[MOTOR_BLOCK];  // 発振器の1サンプルあたりの位相の増分(1で1周期)
+  float rotCos[CarDataClass::CARDATA_MAX_MOTOR_SET_NUM][MOTOR_BLOCK];  // 発振器の1サンプルあたりの回転量
+  float rotSin[CarDataClass::CARDATA_MAX_MOTOR_SET_NUM][MOTOR_BLOCK];
+
+  // size/4 個ぶんのサンプルを MOTOR_BLOCK 個ずつ生成する
+  const size_t sampleNum = size / 4;
+  for (size_t i0 = 0; i0 < sampleNum; i0 += MOTOR_BLOCK) {
+    const size_t num = (sampleNum - i0 < MOTOR_BLOCK) ? sampleNum - i0 : MOTOR_BLOCK;
+    const size_t numVec = (num + Vec4f::WIDTH - 1) / Vec4f::WIDTH * Vec4f::WIDTH;
+
+    // 小歯車の回転数と、各セットの発振器の回転量を求める. 回転量は SIMD の sin/cos カーネルでまとめて計算する
+    for (size_t k = 0; k < numVec; k++) {
+      rpsSmallGear[k] = speed[i0 + ((k < num) ? k : num - 1)] * coeffSpdToRps;  // 端数は最後のサンプルで埋める
+    }
+    for (size_t m = 0; m < setNum; m++) {
+      for (size_t k = 0; k < numVec; k++) {
+        step[k] = rpsSmallGear[k] * oscRatio[m] * T_SAMPLE_F;
+      }
+      sinCosCycleBlock(step, rotSin[m], rotCos[m], numVec);
+    }
+
+    for (size_t k = 0; k < num; k++) {
+      // 各セットの位相を進め、振幅が0でないセットだけ瞬時値を計算する. 高調波の和は発振器の漸化式で求める
+      float output = 0.0;
+      for (size_t m = 0; m < setNum; m++) {
+        _osc[m].rotate(rotCos[m][k], rotSin[m][k]);
+        float amp = (rpsSmallGear[k] * sourceRatio[m] - _carData._listMotorRpsStart[m]) * _carData._listMotorEnvSlope[m];
+        if (amp <= 0.0) continue;
+        if (_carData._listMotorSource[m] == MOTOR_SOUND_MESH && !_isEngagementPlay) continue;
+        if (amp > 1.0) amp = 1.0;
+        output += _osc[m].calc(_carData._listMotorWeight[m], _carData._listMotorOrderNum[m]) * amp;
+      }
+      output /= 2.0;
+      output = _firstHPF.update(output, T_SAMPLE);
+      output = _firstLPF.update(output, T_SAMPLE);
+
+      // 出力
+      int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*(i0 + k)]);
+      int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*(i0 + k)+2]);
+      *pResultL = output * _volume;
+      *pResultR = output * _volume;
+    }
+  }
+  return 1;
+}
+
+#ifdef USE_FIXED_POINT
+/// @brief generateSound の固定小数点版. 位相は2^32で1周期の整数で持つので、k倍高調波の位相は単にk倍すればよい(発振器は使わない).
+///        振幅はQ15、フィルタ内部はQ20で計算する
+int MotorSoundClass::generateSoundFixed(uint8_t* buf, int size, float* speed) {
   float gr = _carData._largeGear / _carData._smallGear;
-  FirstHPF firstHPF1, firstHPF2;
-  firstHPF1.setTau(1.0/300.0);
-  firstHPF2.setTau(1.0/300.0);
-  FirstLPF firstLPF;
-  firstLPF.setTau(1.0/2000.0);
+
+  // 高調波の重み(Q15)
+  const size_t setNum = _carData._motorSetNum;
+  int32_t weightQ[CarDataClass::CARDATA_MAX_MOTOR_SET_NUM][CarDataClass::CARDATA_MAX_MOTOR_ORDER_NUM];
+  for (size_t m = 0; m < setNum; m++) {
+    for (int k = 0; k < _carData._listMotorOrderNum[m]; k++) {
+      weightQ[m][k] = static_cast<int32_t>(floorf(_carData._listMotorWeight[m][k] * 32768.0f + 0.5f));
+    }
+  }
 
   // size/4 個ぶんのサンプルを生成する
-  for (size_t i = 0; i < size/4; i++) {
+  const size_t sampleNum = size / 4;
+  for (size_t i = 0; i < sampleNum; i++) {
     // 各ギアの回転数を計算
-    float rpsLargeGear = speed[i] / 3.6 / PI / _carData._wheelDiameter;  // v=rω=2πrfよりf=v/2πr=v/πΦ
-    float rpsSmallGear = rpsLargeGear * gr;
-    float rpsEngage = rpsSmallGear * _carData._smallGear;
-
-    // 各ギアの位相を計算 
-    _phaseLargeGear += rpsLargeGear * 2 * PI * T_SAMPLE;
-    _phaseSmallGear += rpsSmallGear * 2 * PI * T_SAMPLE;
-    _phaseEngage += rpsEngage * 2 * PI * T_SAMPLE;
-    // 2π以下にする
-    if (_phaseLargeGear > 2*PI) { _phaseLargeGear -= (2*PI);}
-    if (_phaseSmallGear > 2*PI) { _phaseSmallGear -= (2*PI);}
-    if (_phaseEngage > 2*PI) { _phaseEngage -= (2*PI);}
-    // _phaseLargeGear -= (int)_phaseLargeGear;
-    // _phaseSmallGear -= (int)_phaseSmallGear;
-    // _phaseEngage -= (int)_phaseEngage;
-
-    // 振幅を計算
-    float ampSmallGear = (rpsSmallGear < 30) ? 0.0 : (rpsSmallGear - 30) / 30;
-    if (ampSmallGear > 1.0) ampSmallGear = 1.0;
-    float ampEngage = (rpsEngage < 30) ? 0.0 : (rpsEngage - 30) / 300;
-    if (ampEngage > 1.0) ampEngage = 1.0;
-
-    // 瞬時値を計算
-    // float ampLargeGear = sin(_phaseLargeGear);
-    float valSmallGear = 0.0;
-    // valSmallGear += sinRough(1*_phaseSmallGear)/4;
-    // valSmallGear += sinRough(2*_phaseSmallGear)/2;
-    valSmallGear += sinRough(4*_phaseSmallGear)/2;
-    // valSmallGear += sinRough(6*_phaseSmallGear)/2;
-    valSmallGear += sinRough(8*_phaseSmallGear)/2;
-    // valSmallGear += sinRough(10*_phaseSmallGear)/4;
-    valSmallGear += sinRough(12*_phaseSmallGear)/3;
-    // valSmallGear += sinRough(14*_phaseSmallGear)/8;
-    valSmallGear += sinRough(16*_phaseSmallGear)/5;
-    // valSmallGear += sinRough(18*_phaseSmallGear)/12;
-    valSmallGear += sinRough(20*_phaseSmallGear)/7;
-    // valSmallGear += sinRough(22*_phaseSmallGear)/12;
-    valSmallGear += sinRough(24*_phaseSmallGear)/9;
-    float valEngage = 0.0;
-    if (_isEngagementPlay) {
-      // valEngage += sinRough(_phaseEngage);
-      // valEngage += sinRough(2*_phaseEngage)/2;
-      // valEngage += sinRough(3*_phaseEngage)/4;
-      // valEngage += sinRough(4*_phaseEngage)/6;
-      // valEngage += sinRough(5*_phaseEngage)/8;
-      valEngage += sinRough(_phaseEngage);
-      valEngage += sinRough(2*_phaseEngage)/2;
-      valEngage += sinRough(3*_phaseEngage);
-      valEngage += sinRough(5*_phaseEngage);
-      // valEngage += sinRough(7*_phaseEngage);
+    float rpsLargeGear = speed[i] / 3.6f / PI_F / _carData._wheelDiameter;  // v=rω=2πrfよりf=v/2πr=v/πΦ
+    float rpsSource[MOTOR_SOUND_SOURCE_NUM];
+    rpsSource[MOTOR_SOUND_ROTOR] = rpsLargeGear * gr;
+    rpsSource[MOTOR_SOUND_MESH] = rpsSource[MOTOR_SOUND_ROTOR] * _carData._smallGear;
+
+    // 各基本周波数の位相を計算(2^32を超えた分は自然に切り捨てられる)
+    for (int src = 0; src < MOTOR_SOUND_SOURCE_NUM; src++) {
+      _phaseQ[src] += static_cast<uint32_t>(rpsSource[src] * PHASE_PER_HZ);
     }
-    float output = (valSmallGear * ampSmallGear + valEngage * ampEngage)/2.0;
-    output = firstHPF1.update(output, T_SAMPLE);
-    // output = firstHPF2.update(output, T_SAMPLE);
-    output = firstLPF.update(output, T_SAMPLE);
+
+    // 振幅(Q15)が0でないセットだけ、重みが0でない高調波の瞬時値(Q15)を足す
+    int64_t sum = 0;
+    for (size_t m = 0; m < setNum; m++) {
+      const int src = _carData._listMotorSource[m];
+      if (src == MOTOR_SOUND_MESH && !_isEngagementPlay) continue;
+      float amp = (rpsSource[src] - _carData._listMotorRpsStart[m]) * _carData._listMotorEnvSlope[m];
+      if (amp <= 0.0f) continue;
+      int32_t ampQ = (amp >= 1.0f) ? 32768 : static_cast<int32_t>(amp * 32768.0f);
+      const uint32_t p = _carData._listMotorBaseOrder[m] * _phaseQ[src];
+      int32_t val = 0;
+      for (int k = 0; k < _carData._listMotorOrderNum[m]; k++) {
+        if (weightQ[m][k] != 0) {
+          val += (_sineTable.lerpQ15((k + 1) * p) * weightQ[m][k]) >> 15;
+        }
+      }
+      sum += (int64_t)val * ampQ;
+    }
+    int32_t output = static_cast<int32_t>(sum >> 16);  // /2 を含む
+    output = _firstHPFQ.update(output << 5);  // Q20
+    output = _firstLPFQ.update(output);
 
     // 出力先アドレスを出力バッファの適切な位置に指定
     int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*i]);
     int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*i+2]);
 
     // 出力
-    *pResultL = output * _volume;
-    *pResultR = output * _volume;
+    *pResultL = static_cast<int16_t>(((int64_t)output * _volume) >> 20);
+    *pResultR = *pResultL;
   }
   return 1;
 }
+#endif
@@ -2,58 +2,35 @@
 
 #include "constant.h"
 #include "CarDataClass.h"
+#include "Filter.h"
+#include "SineTable.h"
+#include "Oscillator.h"
+#include "Simd.h"
 #ifndef ARDUINO_ARCH_ESP32
 #include <math.h>
 #endif
 
 class MotorSoundClass {
 private:
+  static const size_t MOTOR_BLOCK = 64;  // 回転量をまとめて計算するサンプル数(Vec4f::WIDTH の倍数)
+
   const CarDataClass& _carData;
-  float _phaseLargeGear;  // 大歯車の回転角(0 to 2pi)
-  float _phaseSmallGear;  // 小歯車の回転角(0 to 2pi)
-  float _phaseEngage;  // 噛み合い周波数の位相角(0 to 2pi)
+  HarmonicOscillator _osc[CarDataClass::CARDATA_MAX_MOTOR_SET_NUM];  // 車両データの高調波セットごとの発振器. 基本波は基本周波数×基本次数
+  FirstHPF _firstHPF;  // 出力のHPF(300Hz). 状態は generateSound の呼び出しをまたいで保持する
+  FirstLPF _firstLPF;  // 出力のLPF(2000Hz)
+#ifdef USE_FIXED_POINT
+  const SineTable& _sineTable;  // 正弦波テーブル
+  uint32_t _phaseQ[MOTOR_SOUND_SOURCE_NUM];  // 基本周波数(小歯車の回転, 噛み合い周波数)の位相. 2^32で1周期
+  FirstHPFQ _firstHPFQ;  // 固定小数点版のHPF
+  FirstLPFQ _firstLPFQ;  // 固定小数点版のLPF
+
+  int generateSoundFixed(uint8_t* buf, int size, float* speed);
+#endif
 
   int _volume;  // 音量(0-32767)
 
   bool _isEngagementPlay;  // 噛み合い周波数の音を鳴らすかどうか
 
-  /// @brief 簡単なsin波生成
-  /// @param[in] phase 位相(0 to 2pi)
-  /// @retval sin(phase). (-1 to 1)
-  inline float sinRough(float phase) {
-    if (phase < 0.0) {phase = PI - phase;}  // 0以下の場合は0以上に持ってくる
-    while (phase > 2.0 * PI) {phase -= 2.0 * PI;}  // 0から2piの範囲に収める
-    
-    if (phase < 0.5 * PI) {  // 計算
-      return minimaxSin(phase);
-    } else if (phase < 1.5 * PI) {
-      return minimaxSin(PI - phase);
-    } else {
-      return minimaxSin(phase - 2.0*PI);
-    }
-  }
-
-  inline float minimaxSin(float phase) {
-    // https://interface.cqpub.co.jp/wp-content/uploads/if08_148.pdf
-    // HP内の x を 2Θ/π でおきかえて、-π/2 < Θ < π/2 に対応
-    const float a1 = 1.0;
-    const float a3 = -0.1666482838;
-    const float a5 = 0.008306325184;
-    return phase*(a1 + phase*phase*(a3 + phase*phase*a5));
-    // const float a7 = -0.0001836365274;
-    // return phase*(a1 + phase*phase*(a3 + phase*phase*(a5 + a7*phase*phase)));
-  }
-
-  /// @brief のこぎり波生成
-  /// @param[in] phase 位相(0 to 1)
-  /// @retval amp 波形の瞬時値. (-1 to 1)
-  inline float sawTooth(float phase) {
-    while (phase < 0.0) {phase += 1.0;}  // 0以上にする
-    while (phase > 1.0) {phase -= 1.0;}  // 1以下にする
-    return phase * 2.0 - 1.0;
-    // return sin(phase) + 1.0/2.0*sin(2*phase) + 1.0/4.0*sin(3*phase) + 1.0/8.0*sin(4*phase);
-  }
-
 public:
   /// @brief モーター音生成クラス
   /// @param[in] carData 音を鳴らしたい車両の車両データ
@@ -74,7 +51,8 @@ public:
   /// @retval 1:success, 0:fail
   int setEngagementPlay(bool isPlay);
 
-  /// @brief ある速度における音データをsize[bytes]ぶん生成する
+  /// @brief ある速度における音データをsize[bytes]ぶん生成する. 位相とフィルタの状態は呼び出しをまたいで引き継ぐので、
+  ///        小さなブロックに分けて呼び出しても、まとめて1回で生成した場合と同じ出力になる
   /// @param[out] buf 生成したPCMデータが格納されるバッファへのポインタ
   /// @param[in] size 生成する音データのサイズ(bytes). サンプル数は size/4 個になる
   /// @param[in] speed 各サンプリング点における走行速度[km/h]を size/4 個ぶん格納した配列
@@ -0,0 +1,55 @@
+#pragma once
+
+/// @brief 基本波とその整数倍の高調波を重み付きで足し合わせた波形を生成する発振器.
+///        基本波は (cos, sin) の組(フェーザ)を毎サンプル回転させて求め、位相からsinを評価しない.
+///        高調波の和 Σ w_k sin(kθ) は Chebyshev 漸化式 sin(kθ) = 2cosθ sin((k-1)θ) - sin((k-2)θ) に基づく
+///        Clenshaw 法で求めるので、1サンプルあたりの計算量は最大次数ぶんの積和だけで済む.
+///        重みは呼び出し側が持つ(車両データの高調波テーブルを直接渡せるようにするため)
+class HarmonicOscillator {
+ public:
+  static const int ORDER_MAX = 32;  // 高調波の最大次数
+
+ private:
+  float _cos;  // 基本波の位相θのcos
+  float _sin;  // 基本波の位相θのsin
+
+ public:
+  HarmonicOscillator() {
+    reset();
+  }
+
+  /// @brief 基本波の位相を0に戻す
+  void reset() {
+    _cos = 1.0f;
+    _sin = 0.0f;
+  }
+
+  /// @brief 基本波の位相を進める. 丸め誤差で振幅がずれないよう毎回ニュートン法1回ぶんの正規化をかける.
+  ///        回転量のcos,sinは呼び出し側で sinCosCycleBlock() 等によりまとめて求めておく
+  /// @param[in] cosStep 位相の増分のcos
+  /// @param[in] sinStep 位相の増分のsin
+  inline void rotate(const float cosStep, const float sinStep) {
+    const float c = _cos * cosStep - _sin * sinStep;
+    const float s = _sin * cosStep + _cos * sinStep;
+    const float g = 1.5f - 0.5f * (c * c + s * s);  // 1/sqrt(c^2+s^2) の近似
+    _cos = c * g;
+    _sin = s * g;
+  }
+
+  /// @brief 現在の位相における波形の瞬時値を求める
+  /// @param[in] weight 高調波の重み. weight[k-1] が k次の重み
+  /// @param[in] order 最大次数(0 to ORDER_MAX). 0のときは0を返す
+  /// @retval Σ weight[k-1] sin(kθ)
+  inline float calc(const float* weight, const int order) const {
+    // Clenshaw 法: b_k = w_k + 2cosθ b_{k+1} - b_{k+2} を上の次数から計算し、b_1 sinθ が求める和になる
+    const float c2 = 2.0f * _cos;
+    float b1 = 0.0f;
+    float b2 = 0.0f;
+    for (int k = order; k >= 1; k--) {
+      const float b0 = weight[k - 1] + c2 * b1 - b2;
+      b2 = b1;
+      b1 = b0;
+    }
+    return b1 * _sin;
+  }
+};
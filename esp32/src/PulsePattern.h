@@ -0,0 +1,295 @@
+#pragma once
+
+#include "constant.h"
+#include "CarDataClass.h"
+#include "SineTable.h"
+#ifndef ARDUINO_ARCH_ESP32
+#include <math.h>
+#endif
+
+/// @brief 同期モードのキャリア波形(-1 to 1). U相の信号波1周期を repeat 個の区間に等分し、各区間をさらに
+///        bumpNum 個に等分して、それぞれに山(0→1→0)または谷(0→-1→0)を置いた折れ線で表す.
+///        パルスモードが変わったときに setup() で作成し、サンプルごとのパルス数による分岐をなくす
+class SyncCarrierClass {
+ public:
+  static const int BUMP_MAX = 256;  // 1区間あたりの山・谷の数の上限
+
+  int Npulse;        // パルス数. 0のときは未作成
+  int repeat;        // 信号波1周期あたりの区間の数
+  int bumpNum;       // 1区間あたりの山・谷の数
+  bool isTriangle;   // 谷,山の順に並んだ通常の三角波かどうか(SIMDカーネルで直接計算できる)
+  int8_t bumpSign[BUMP_MAX];  // 各山・谷の符号. 1:山, -1:谷
+
+  SyncCarrierClass() : Npulse(0), repeat(1), bumpNum(2), isTriangle(true) {
+    bumpSign[0] = -1;
+    bumpSign[1] = 1;
+  }
+
+  /// @brief キャリア波形を作成する.
+  ///        パルス数が3の倍数のときは、信号波1周期にパルス数ぶんの三角波(谷,山)を並べる.
+  ///        3の倍数でない奇数のときは、3相で同じ波形を使えるよう信号波の1/3周期を1区間とし、区間の前半にK個、後半に符号を反転したK個の山・谷を置く.
+  ///        K=(Npulse±1)/3 (偶数)とし、三角波のように山・谷を交互に並べたうえで、各半区間の先頭だけを隣と同じ向きに折り返すとパルス数がNpulseになる.
+  ///        (Npulse=5 では谷,谷,山,山となる). 偶数と1パルスは3相対称にできないので、U相基準の三角波とする
+  /// @param[in] npulse パルス数
+  void setup(const int npulse) {
+    Npulse = npulse;
+    int K = 0;  // 半区間あたりの山・谷の数
+    int sign = 0;  // 各半区間の先頭の山・谷の符号
+    if (npulse % 6 == 5) {
+      K = (npulse + 1) / 3;
+      sign = -1;
+    } else if (npulse % 6 == 1 && npulse > 1) {
+      K = (npulse - 1) / 3;
+      sign = 1;
+    }
+
+    if (K == 0 || 2 * K > BUMP_MAX) {
+      repeat = (npulse > 0) ? npulse : 1;
+      bumpNum = 2;
+      isTriangle = true;
+      bumpSign[0] = -1;
+      bumpSign[1] = 1;
+      return;
+    }
+    repeat = 3;
+    bumpNum = 2 * K;
+    isTriangle = false;
+    bumpSign[0] = sign;
+    for (int j = 1; j < K; j++) {
+      bumpSign[j] = (j & 1) ? sign : -sign;
+    }
+    for (int j = 0; j < K; j++) {
+      bumpSign[K + j] = -bumpSign[j];  // 後半は前半の符号を反転する(半波対称)
+    }
+  }
+
+  /// @brief キャリアの瞬時値を求める
+  /// @param[in] phaseU U相の信号波位相(0 to 1)
+  /// @retval キャリアの瞬時値(-1 to 1)
+  inline float calc(const float phaseU) const {
+    float x = phaseU * repeat;
+    x -= (int)x;
+    x *= bumpNum;
+    int i = static_cast<int>(x);
+    float t = x - i;  // 山・谷の中の位置(0 to 1)
+    return bumpSign[i] * ((t < 0.5f) ? 2.0f * t : 2.0f - 2.0f * t);
+  }
+#ifdef USE_FIXED_POINT
+  /// @brief キャリアの瞬時値を固定小数点で求める
+  /// @param[in] phaseU U相の信号波位相. 2^32で1周期
+  /// @retval キャリアの瞬時値(Q15)
+  inline int32_t calcQ15(const uint32_t phaseU) const {
+    uint64_t x = static_cast<uint64_t>(phaseU * static_cast<uint32_t>(repeat)) * bumpNum;  // 2^32を超えた分が山・谷の番号
+    int32_t t = static_cast<uint32_t>(x) >> 16;  // 山・谷の中の位置(Q16)
+    return bumpSign[x >> 32] * ((t < 32768) ? t : 65536 - t);
+  }
+#endif
+};
+
+/// @brief スイッチング角を指定するモード(SYNC_W3P, SYNC_1P, SYNC_ANGLE)における信号波の1/4周期内のスイッチング角.
+///        相電圧出力は1/4波対称とし、正の半周期の中央(位相1/4)では常に1、位相0から1/4の間はスイッチング角ごとに反転する
+class SwitchingAngleClass {
+ public:
+  int angleNum;  // スイッチング角の数
+  float angles[CarDataClass::CARDATA_MAX_ANGLE_NUM];  // スイッチング角(昇順, 1で信号波1周期. 0 to 0.25)
+
+  SwitchingAngleClass() : angleNum(0) {}
+
+  /// @brief スイッチング角を指定するモードかどうか
+  /// @param[in] mode パルスモードの種類(Mode)
+  /// @retval スイッチング角を指定するモードのとき true
+  static inline bool isAngleMode(const int mode) {
+    return mode == SYNC_W3P || mode == SYNC_1P || mode == SYNC_ANGLE;
+  }
+
+  /// @brief スイッチング角を求める.
+  ///        SYNC_W3P では角度αを1つとし、基本波振幅が1パルスのVs倍となるよう 2cos(2πα)-1=Vs から求める(Vs=1でα=0, 1パルスになる).
+  ///        SYNC_1P では角度なし、SYNC_ANGLE ではJSONの表をVsで線形補間する
+  /// @param[in] carData 車両データ
+  /// @param[in] pmIndex パルスモードのインデックス
+  /// @param[in] Vs モータ電圧(0 to 1)
+  void setup(const CarDataClass& carData, const size_t pmIndex, const float Vs) {
+    angleNum = 0;
+    switch (carData._listMode[pmIndex]) {
+    case SYNC_W3P: {
+      float v = (Vs < 0.0f) ? 0.0f : ((Vs > 1.0f) ? 1.0f : Vs);
+      angles[0] = acos(0.5f * (1.0f + v)) / (2.0f * PI_F);
+      angleNum = (angles[0] > 0.0f) ? 1 : 0;
+      break;
+    }
+    case SYNC_ANGLE: {
+      const size_t rowNum = carData._listAngleRowNum[pmIndex];
+      if (rowNum == 0) {
+        break;
+      }
+      // Vsを挟む2行を探して線形補間する. 表の範囲外では端の行を用いる
+      const float* rowVs = carData._listAngleVs[pmIndex];
+      size_t r = 0;
+      while (r + 1 < rowNum && Vs >= rowVs[r + 1]) r++;
+      float alpha = 0.0f;
+      if (r + 1 < rowNum && Vs > rowVs[r]) {
+        alpha = (Vs - rowVs[r]) / (rowVs[r + 1] - rowVs[r]);
+      }
+      const size_t r2 = (r + 1 < rowNum) ? r + 1 : r;
+      angleNum = static_cast<int>(carData._listAngleNum[pmIndex]);
+      for (int a = 0; a < angleNum; a++) {
+        float x = carData._listAngle[pmIndex][r][a];
+        angles[a] = x + alpha * (carData._listAngle[pmIndex][r2][a] - x);
+      }
+      break;
+    }
+    default:
+      break;  // SYNC_1P
+    }
+  }
+
+  /// @brief 1相ぶんの相電圧出力を求める
+  /// @param[in] phase 信号波位相(0 to 1)
+  /// @retval 相電圧出力
+  inline bool calc(const float phase) const {
+    const bool isNegativeHalf = (phase >= 0.5f);
+    float q = isNegativeHalf ? phase - 0.5f : phase;  // 半周期内の位相(0 to 0.5)
+    if (q > 0.25f) q = 0.5f - q;  // 1/4周期で折り返す
+    int count = 0;  // qより大きいスイッチング角の数
+    for (int a = 0; a < angleNum; a++) {
+      count += (angles[a] > q);
+    }
+    return ((count & 1) == 0) != isNegativeHalf;
+  }
+};
+
+/// @brief 1周期ぶんの相電圧出力パターン. 同期モードおよびスイッチング角を指定するモードで、(パルスモード, 量子化したVs) の組ごとに作成する.
+///        作成したパターンはU相の信号波位相で引くだけでよく、キャリアの計算や比較が不要になる
+class SyncPatternClass {
+ public:
+  static const int TABLE_BITS = 12;               // 1周期あたりの分割数(2^TABLE_BITS)
+  static const int TABLE_SIZE = 1 << TABLE_BITS;
+  static const int VS_STEPS = 256;                // 作成時のVsの量子化段数(Vs=1のときVS_STEPS)
+
+  bool valid;      // 作成済みかどうか
+  size_t pmIndex;  // パルスモードのインデックス
+  int mode;        // パルスモードの種類. 車両データが変わった場合に作り直すために pmIndex と合わせて照合する
+  int Npulse;      // パルス数. 同上
+  int vsStep;      // 量子化したVs
+  uint8_t pattern[TABLE_SIZE];  // U相の信号波位相で引く. bit0,1,2がそれぞれU,V,W相の相電圧出力
+  float fundamental;  // 相電圧出力(0または1)の基本波のうち、信号波 sin(2π*phase) と同相の成分の振幅
+
+  SyncPatternClass() : valid(false), pmIndex(0), mode(0), Npulse(0), vsStep(0), fundamental(0.0f) {}
+
+  /// @brief 指定された (パルスモード, 量子化したVs) のパターンかどうか
+  inline bool matches(const CarDataClass& carData, const size_t pm, const int vs) const {
+    return valid && pmIndex == pm && vsStep == vs && mode == carData._listMode[pm] && Npulse == carData._listNpulse[pm];
+  }
+
+  /// @brief パターンを作成する. 同期モードではキャリアと信号波を比較し、スイッチング角を指定するモードでは SwitchingAngleClass の角度から作成する.
+  ///        あわせてU相の出力をフーリエ展開し、基本波の振幅を求める
+  /// @param[in] carData 車両データ
+  /// @param[in] pm パルスモードのインデックス
+  /// @param[in] vs 量子化したVs
+  /// @param[in,out] carrier 同期モードのキャリア波形. パルス数が異なる場合は作り直される
+  /// @param[in] sineTable 信号波の計算に用いる正弦波テーブル
+  /// @param[in] precision 信号波の計算精度
+  void build(const CarDataClass& carData, const size_t pm, const int vs, SyncCarrierClass& carrier,
+             const SineTable& sineTable, const SinePrecision precision) {
+    const float Vs = static_cast<float>(vs) / VS_STEPS;
+    const bool isAngleMode = SwitchingAngleClass::isAngleMode(carData._listMode[pm]);
+    SwitchingAngleClass angles;
+    if (isAngleMode) {
+      angles.setup(carData, pm, Vs);
+    } else if (carrier.Npulse != carData._listNpulse[pm]) {
+      carrier.setup(carData._listNpulse[pm]);
+    }
+    float sum = 0.0f;
+    for (int j = 0; j < TABLE_SIZE; j++) {
+      float phaseU = (j + 0.5f) / TABLE_SIZE;  // 各区間の中央の位相で代表させる
+      float phase[3] = {phaseU, phaseU + 2.0f/3.0f, phaseU + 1.0f/3.0f};  // V,W相はU相から1/3周期ずつ遅れる
+      phase[1] -= (int)phase[1];
+      phase[2] -= (int)phase[2];
+      const float sinU = sineTable.calc(phaseU, precision);
+      uint8_t bits = 0;
+      if (isAngleMode) {
+        for (int i_p = 0; i_p < 3; i_p++) {
+          if (angles.calc(phase[i_p])) bits |= (1 << i_p);
+        }
+      } else {
+        float ampCarrier = carrier.calc(phaseU);
+        for (int i_p = 0; i_p < 3; i_p++) {
+          if (Vs * sineTable.calc(phase[i_p], precision) >= ampCarrier) bits |= (1 << i_p);
+        }
+      }
+      pattern[j] = bits;
+      sum += (bits & 0x1) ? sinU : -sinU;
+    }
+    fundamental = sum / TABLE_SIZE;  // 2/N * Σ(出力-1/2)*sin
+    pmIndex = pm;
+    mode = carData._listMode[pm];
+    Npulse = carData._listNpulse[pm];
+    vsStep = vs;
+    valid = true;
+  }
+
+  /// @brief パターンを引く
+  /// @param[in] phaseU U相の信号波位相(0 to 1)
+  /// @retval bit0,1,2がそれぞれU,V,W相の相電圧出力
+  inline uint8_t lookup(const float phaseU) const {
+    return pattern[static_cast<int>(phaseU * TABLE_SIZE) & (TABLE_SIZE - 1)];
+  }
+};
+
+/// @brief SyncPatternClass のキャッシュ. 最近使った CACHE_NUM 個のパターンを保持し、Vsの量子化段の境界で行き来しても作り直さないようにする
+class SyncPatternCacheClass {
+ public:
+  static const size_t CACHE_NUM = 2;  // キャッシュしておくパターンの数
+
+  SyncPatternCacheClass() : _next(0) {}
+
+  /// @brief キャッシュをすべて無効にする
+  void clear() {
+    for (size_t c = 0; c < CACHE_NUM; c++) {
+      _pattern[c].valid = false;
+    }
+    _next = 0;
+  }
+
+  /// @brief 指定された (パルスモード, 量子化したVs) に対応するパターンを取得する. キャッシュにない場合は最も古いものを上書きして作成する
+  /// @param[in] carData 車両データ
+  /// @param[in] pm パルスモードのインデックス
+  /// @param[in] vs 量子化したVs
+  /// @param[in,out] carrier 同期モードのキャリア波形. パルス数が異なる場合は作り直される
+  /// @param[in] sineTable 信号波の計算に用いる正弦波テーブル
+  /// @param[in] precision 信号波の計算精度
+  /// @retval パターンへの参照
+  const SyncPatternClass& get(const CarDataClass& carData, const size_t pm, const int vs, SyncCarrierClass& carrier,
+                              const SineTable& sineTable, const SinePrecision precision) {
+    for (size_t c = 0; c < CACHE_NUM; c++) {
+      if (_pattern[c].matches(carData, pm, vs)) {
+        return _pattern[c];
+      }
+    }
+    SyncPatternClass& rPattern = _pattern[_next];
+    _next = (_next + 1) % CACHE_NUM;
+    rPattern.build(carData, pm, vs, carrier, sineTable, precision);
+    return rPattern;
+  }
+
+ private:
+  SyncPatternClass _pattern[CACHE_NUM];
+  size_t _next;  // 次に上書きするパターンの番号
+};
+
+/// @brief 非同期キャリア周波数のランダム変調に用いる乱数(xorshift32). インバータ(ユニット)ごとに状態を持つ
+class CarrierRandomClass {
+ public:
+  uint32_t state;  // 乱数の状態. 0以外
+
+  CarrierRandomClass() : state(2463534242u) {}
+
+  /// @brief 乱数を1つ生成する
+  /// @retval -1 から 1 の一様乱数
+  inline float next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return static_cast<float>(state) * (2.0f / 4294967296.0f) - 1.0f;
+  }
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "constant.h"
+#include "CarDataClass.h"
+
+/// @brief 走行速度から制御量(信号波周波数・信号波電圧・パルスモード)を求める.
+///        制御周期ごとの制御点で走行速度からこれらを求め、制御点の間の信号波周波数と信号波電圧は次の制御点の値へ直線補間する.
+///        BLOCK サンプルずつまとめて求める. VVVFSoundClass と VVVFConsistClass で共有する
+class PwmControlClass {
+ public:
+  static const size_t BLOCK = 256;            // 制御量をまとめて求めるサンプル数
+  static const int PERIOD_MAX = 64;           // 制御周期の上限[サンプル]
+  static const uint8_t PM_INDEX_NONE = 0xFF;  // pmIndex で該当するパルスモードがない(fsが最初のパルスモード未満)ことを表す値
+
+  float fs[BLOCK];  // 各サンプルの信号波周波数[Hz](すべり込み)
+  float vs[BLOCK];  // 各サンプルの信号波電圧
+  uint8_t pmIndex[BLOCK];  // 各制御点のパルスモードのインデックス. 制御点 c*period の値が c 番目に入る
+
+  /// @brief 信号波電圧を計算する
+  /// @param[in] carData 車両データ
+  /// @param[in] fs 信号波周波数[Hz]
+  /// @retval 信号波電圧(0 to 1)
+  static inline float calcVs(const CarDataClass& carData, const float fs) {
+    if (fs > carData._modulationMaxFreq) {
+      return carData._modulationMax;  // 最大電圧に達する周波数を超えている場合
+    }
+    return 0.03 + 0.97 * carData._modulationMax * fs / carData._modulationMaxFreq;  // V/f一定で上昇.ブーストを3%とる
+  }
+
+  /// @brief 1ブロックぶんの制御量を求める
+  /// @param[in] carData 車両データ
+  /// @param[in] speed このブロックの先頭からの走行速度[km/h]の配列
+  /// @param[in] num ブロックのサンプル数(BLOCK以下)
+  /// @param[in] remain speed の有効な要素数(num以上). 最後の制御点の補間の終点を次のブロックから取るために用いる
+  /// @param[in] coeffSpdToFs speed から fs へ換算する係数
+  /// @param[in] period 制御周期[サンプル](1 to PERIOD_MAX)
+  void calc(const CarDataClass& carData, const float* speed, size_t num, size_t remain, float coeffSpdToFs, size_t period) {
+    for (size_t c = 0; c < num; c += period) {
+      float fsCtrl = speed[c] * coeffSpdToFs + 2.0;  // すべり周波数として2.0を付加
+      float vsCtrl = calcVs(carData, fsCtrl);
+      fs[c] = fsCtrl;
+      vs[c] = vsCtrl;
+      int pm = carData.getPulsemodeIndex(fsCtrl);
+      pmIndex[c / period] = (pm < 0) ? PM_INDEX_NONE : static_cast<uint8_t>(pm);
+
+      // 補間の終点は次の制御点. バッファの末尾を越える場合は最後のサンプルとする
+      size_t next = (c + period < remain) ? c + period : remain - 1;
+      size_t len = (num - c < period) ? num - c : period;
+      if (len < 2 || next <= c) {
+        continue;
+      }
+      float fsNext = speed[next] * coeffSpdToFs + 2.0;
+      float stepFs = (fsNext - fsCtrl) / (next - c);
+      float stepVs = (calcVs(carData, fsNext) - vsCtrl) / (next - c);
+      for (size_t k = 1; k < len; k++) {
+        fs[c + k] = fsCtrl + stepFs * k;
+        vs[c + k] = vsCtrl + stepVs * k;
+      }
+    }
+  }
+
+  /// @brief サンプルのパルスモードのインデックスを取得する
+  /// @param[in] i ブロックの先頭からのサンプル番号
+  /// @param[in] period 制御周期[サンプル]
+  /// @retval パルスモードのインデックス. 該当なしは -1
+  inline int pmIndexAt(const size_t i, const size_t period) const {
+    const uint8_t pm = pmIndex[i / period];
+    return (pm == PM_INDEX_NONE) ? -1 : pm;
+  }
+};
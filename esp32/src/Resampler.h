@@ -0,0 +1,107 @@
+#pragma once
+
+#include "constant.h"
+#include "Simd.h"
+#ifndef ARDUINO_ARCH_ESP32
+#include <math.h>
+#endif
+
+/// @brief 音源を任意の再生速度で再生するときの補間方式
+typedef enum ResampleKernel {
+  RESAMPLE_LINEAR,   // 2点の線形補間. 最も軽いが、補間誤差による雑音と折り返しが大きい
+  RESAMPLE_HERMITE,  // 4点の3次エルミート補間(Catmull-Rom). 計算量は線形補間の1.5倍程度で、雑音が小さい
+  RESAMPLE_SINC,     // 窓付きsincによる8点の補間. 係数はポリフェーズテーブルを位相について線形補間して求める
+  RESAMPLE_KERNEL_NUM
+} ResampleKernel;
+
+/// @brief ステレオ(L, R の順に並んだ符号付16bit整数)の音源から、フレーム間の任意の位置の値を補間して求める.
+///        1回の補間で L, R を Vec4f の2要素ずつに並べて同時に計算する(2フレーム = 4要素を1回で読み込む).
+///        sincの係数テーブルは全インスタンスで共有するので、Resampler::instance() から参照を得て使う
+class Resampler {
+ public:
+  static const int SINC_TAPS = 8;                    // sincのタップ数(フレーム数)
+  static const int SINC_PHASES = 64;                 // テーブルの位相の分割数
+  static const int EDGE_BEFORE = SINC_TAPS / 2 - 1;  // 補間位置のフレームより前に読む最大のフレーム数
+  static const int EDGE_AFTER = SINC_TAPS / 2;       // 補間位置のフレームより後に読む最大のフレーム数
+
+  /// @brief 共有のテーブルを取得する. 初回呼び出し時にテーブルが作成される
+  static const Resampler& instance() {
+    static const Resampler resampler;
+    return resampler;
+  }
+
+  /// @brief 3次エルミート補間で frame と frame+1 の間の値を求める. frame-1 から frame+2 を読む
+  /// @param[in] frame 補間位置の直前のフレームの先頭(L)を指すポインタ
+  /// @param[in] alpha 補間位置(0～1). 0 は frame 側、1 は frame+1 側
+  /// @retval 部分和 (L, R, L, R). sumHalves() で L, R を得る
+  static inline Vec4f hermite(const int16_t* frame, const float alpha) {
+    // 各タップの重みは alpha の3次式. 前半は (w-1, w-1, w0, w0), 後半は (w1, w1, w2, w2) の並びで Horner 法により求める
+    static const float c3a[4] = {-0.5f, -0.5f, 1.5f, 1.5f}, c2a[4] = {1.0f, 1.0f, -2.5f, -2.5f}, c1a[4] = {-0.5f, -0.5f, 0.0f, 0.0f}, c0a[4] = {0.0f, 0.0f, 1.0f, 1.0f};
+    static const float c3b[4] = {-1.5f, -1.5f, 0.5f, 0.5f}, c2b[4] = {2.0f, 2.0f, -0.5f, -0.5f}, c1b[4] = {0.5f, 0.5f, 0.0f, 0.0f};
+    const Vec4f t = Vec4f::set1(alpha);
+    Vec4f wa = ((Vec4f::load(c3a) * t + Vec4f::load(c2a)) * t + Vec4f::load(c1a)) * t + Vec4f::load(c0a);
+    Vec4f wb = ((Vec4f::load(c3b) * t + Vec4f::load(c2b)) * t + Vec4f::load(c1b)) * t;
+    return Vec4f::loadInt16(frame - 2) * wa + Vec4f::loadInt16(frame + 2) * wb;
+  }
+
+  /// @brief 窓付きsincで frame と frame+1 の間の値を求める. frame-EDGE_BEFORE から frame+EDGE_AFTER を読む
+  /// @param[in] frame 補間位置の直前のフレームの先頭(L)を指すポインタ
+  /// @param[in] alpha 補間位置(0～1). 0 は frame 側、1 は frame+1 側
+  /// @retval 部分和 (L, R, L, R). sumHalves() で L, R を得る
+  inline Vec4f sinc(const int16_t* frame, const float alpha) const {
+    float x = alpha * SINC_PHASES;
+    int phase = static_cast<int>(x);
+    const Vec4f beta = Vec4f::set1(x - phase);  // テーブルの行の間の線形補間の位置
+    const float* w0 = &_sincTable[phase][0];
+    const float* w1 = &_sincTable[phase + 1][0];
+    const int16_t* p = frame - 2 * EDGE_BEFORE;
+    Vec4f acc = Vec4f::set1(0.0f);
+    for (int n = 0; n < 2 * SINC_TAPS; n += Vec4f::WIDTH) {
+      Vec4f a = Vec4f::load(&w0[n]);
+      Vec4f w = a + beta * (Vec4f::load(&w1[n]) - a);
+      acc = acc + Vec4f::loadInt16(&p[n]) * w;
+    }
+    return acc;
+  }
+
+  /// @brief 音源の端で、補間に使うフレームを範囲外を0として tmp に集める
+  /// @param[in] pcm 音源の先頭を指すポインタ
+  /// @param[in] frames 音源のフレーム数
+  /// @param[in] i 補間位置の直前のフレーム番号
+  /// @param[out] tmp 作業領域. 2*SINC_TAPS 個
+  /// @retval tmp 上で i 番目のフレームに相当する位置を指すポインタ. hermite(), sinc() に渡す
+  static inline const int16_t* gatherEdge(const int16_t* pcm, const int frames, const int i, int16_t* tmp) {
+    for (int n = 0; n < SINC_TAPS; n++) {
+      int f = i - EDGE_BEFORE + n;
+      bool inside = (f >= 0 && f < frames);
+      tmp[2 * n] = inside ? pcm[2 * f] : 0;
+      tmp[2 * n + 1] = inside ? pcm[2 * f + 1] : 0;
+    }
+    return &tmp[2 * EDGE_BEFORE];
+  }
+
+ private:
+  float _sincTable[SINC_PHASES + 1][2 * SINC_TAPS];  // 位相ごとの各タップの重み. L, R 用に同じ値を2つずつ並べる
+
+  Resampler() {
+    const double cutoff = 0.9;  // 遮断周波数(音源のナイキスト周波数に対する比)
+    for (int phase = 0; phase <= SINC_PHASES; phase++) {
+      float alpha = static_cast<float>(phase) / SINC_PHASES;
+      double w[SINC_TAPS];
+      double sum = 0.0;
+      for (int n = 0; n < SINC_TAPS; n++) {
+        double x = (n - EDGE_BEFORE) - alpha;  // 補間位置からみたタップの位置[フレーム]
+        double sinc = (x == 0.0) ? 1.0 : sin(PI * cutoff * x) / (PI * cutoff * x);
+        double window = (fabs(x) >= SINC_TAPS / 2) ? 0.0 : 0.42 + 0.5 * cos(PI * x / (SINC_TAPS / 2)) + 0.08 * cos(2 * PI * x / (SINC_TAPS / 2));  // Blackman窓
+        w[n] = sinc * window;
+        sum += w[n];
+      }
+      for (int n = 0; n < SINC_TAPS; n++) {
+        _sincTable[phase][2 * n] = static_cast<float>(w[n] / sum);  // 直流のゲインを位相によらず1にそろえる
+        _sincTable[phase][2 * n + 1] = _sincTable[phase][2 * n];
+      }
+    }
+  }
+  Resampler(const Resampler&);
+  Resampler& operator=(const Resampler&);
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "constant.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_USE_SSE2
+#endif
+
+/// @brief 4要素の単精度浮動小数点ベクトル.
+///        SSE2が使える環境(x86ホスト. AVX有効時はVEX命令にコンパイルされる)ではSSE2命令で、それ以外(ESP32等)ではスカラ演算で処理する
+class Vec4f {
+ public:
+  static const int WIDTH = 4;
+
+#ifdef SIMD_USE_SSE2
+  __m128 v;
+
+  Vec4f() {}
+  Vec4f(const __m128 x) : v(x) {}
+
+  static inline Vec4f set1(const float x) { return Vec4f(_mm_set1_ps(x)); }
+  static inline Vec4f load(const float* p) { return Vec4f(_mm_loadu_ps(p)); }
+  /// @brief 符号付16bit整数4つを読み込んで単精度に変換する
+  static inline Vec4f loadInt16(const int16_t* p) {
+    __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return Vec4f(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));  // 上位16bitに置いて算術シフトで符号拡張
+  }
+  inline void store(float* p) const { _mm_storeu_ps(p, v); }
+
+  inline Vec4f operator+(const Vec4f& b) const { return Vec4f(_mm_add_ps(v, b.v)); }
+  inline Vec4f operator-(const Vec4f& b) const { return Vec4f(_mm_sub_ps(v, b.v)); }
+  inline Vec4f operator*(const Vec4f& b) const { return Vec4f(_mm_mul_ps(v, b.v)); }
+
+  /// @brief 0に向かって丸めた整数値
+  inline Vec4f truncate() const { return Vec4f(_mm_cvtepi32_ps(_mm_cvttps_epi32(v))); }
+  /// @brief 絶対値
+  inline Vec4f abs() const { return Vec4f(_mm_andnot_ps(_mm_set1_ps(-0.0f), v)); }
+  /// @brief 絶対値が自身、符号が sign の値
+  inline Vec4f copySign(const Vec4f& sign) const {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    return Vec4f(_mm_or_ps(_mm_andnot_ps(signMask, v), _mm_and_ps(signMask, sign.v)));
+  }
+  /// @brief 0以上の要素は1, それ以外は0
+  inline Vec4f geZero() const { return Vec4f(_mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f))); }
+  /// @brief 要素ごとに a > b ならば x, そうでなければ y を選ぶ
+  static inline Vec4f selectGt(const Vec4f& a, const Vec4f& b, const Vec4f& x, const Vec4f& y) {
+    const __m128 mask = _mm_cmpgt_ps(a.v, b.v);
+    return Vec4f(_mm_or_ps(_mm_and_ps(mask, x.v), _mm_andnot_ps(mask, y.v)));
+  }
+  /// @brief 全要素の和
+  inline float sum() const {
+    __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+  }
+  /// @brief 前半と後半の2要素ずつの和 (v0+v2, v1+v3). L, R, L, R の並びのときは L, R それぞれの和になる
+  inline void sumHalves(float& a, float& b) const {
+    __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    a = _mm_cvtss_f32(t);
+    b = _mm_cvtss_f32(_mm_shuffle_ps(t, t, 1));
+  }
+#else
+  float v[WIDTH];
+
+  Vec4f() {}
+
+  static inline Vec4f set1(const float x) {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = x;
+    return r;
+  }
+  static inline Vec4f load(const float* p) {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = p[i];
+    return r;
+  }
+  static inline Vec4f loadInt16(const int16_t* p) {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = static_cast<float>(p[i]);
+    return r;
+  }
+  inline void store(float* p) const {
+    for (int i = 0; i < WIDTH; i++) p[i] = v[i];
+  }
+
+  inline Vec4f operator+(const Vec4f& b) const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = v[i] + b.v[i];
+    return r;
+  }
+  inline Vec4f operator-(const Vec4f& b) const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = v[i] - b.v[i];
+    return r;
+  }
+  inline Vec4f operator*(const Vec4f& b) const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = v[i] * b.v[i];
+    return r;
+  }
+
+  /// @brief 0に向かって丸めた整数値
+  inline Vec4f truncate() const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = static_cast<float>(static_cast<int>(v[i]));
+    return r;
+  }
+  /// @brief 絶対値
+  inline Vec4f abs() const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = (v[i] < 0.0f) ? -v[i] : v[i];
+    return r;
+  }
+  /// @brief 絶対値が自身、符号が sign の値
+  inline Vec4f copySign(const Vec4f& sign) const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) {
+      float m = (v[i] < 0.0f) ? -v[i] : v[i];
+      r.v[i] = (sign.v[i] < 0.0f) ? -m : m;
+    }
+    return r;
+  }
+  /// @brief 0以上の要素は1, それ以外は0
+  inline Vec4f geZero() const {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = (v[i] >= 0.0f) ? 1.0f : 0.0f;
+    return r;
+  }
+  /// @brief 要素ごとに a > b ならば x, そうでなければ y を選ぶ
+  static inline Vec4f selectGt(const Vec4f& a, const Vec4f& b, const Vec4f& x, const Vec4f& y) {
+    Vec4f r;
+    for (int i = 0; i < WIDTH; i++) r.v[i] = (a.v[i] > b.v[i]) ? x.v[i] : y.v[i];
+    return r;
+  }
+  /// @brief 全要素の和
+  inline float sum() const { return (v[0] + v[2]) + (v[1] + v[3]); }
+  inline void sumHalves(float& a, float& b) const {
+    a = v[0] + v[2];
+    b = v[1] + v[3];
+  }
+#endif
+
+  /// @brief 小数部. 0以上の値に対してのみ正しい
+  inline Vec4f frac() const { return *this - truncate(); }
+
+  /// @brief 負の無限大に向かって丸めた整数値
+  inline Vec4f floor() const {
+    Vec4f t = truncate();
+    return selectGt(t, *this, t - set1(1.0f), t);
+  }
+
+  /// @brief 分岐なしで sin(2π*phase) を求める. 多項式は5次のミニマックス近似
+  ///        (https://interface.cqpub.co.jp/wp-content/uploads/if08_148.pdf)に7次の項を加えたもの(誤差6e-6程度)
+  /// @param[in] phase 位相(-0.5以上. 1で1周期)
+  /// @retval sin(2π*phase). (-1 to 1)
+  static inline Vec4f sinCycle(const Vec4f& phase) {
+    const Vec4f a1 = set1(1.0f);
+    const Vec4f a3 = set1(-0.1666482838f);
+    const Vec4f a5 = set1(0.008306325184f);
+    const Vec4f a7 = set1(-0.0001836365274f);
+    const Vec4f half = set1(0.5f);
+    const Vec4f quarter = set1(0.25f);
+
+    Vec4f x = phase - (phase + half).truncate();  // -0.5 to 0.5 に収める
+    Vec4f ax = x.abs();
+    Vec4f folded = selectGt(ax, quarter, (half - ax).copySign(x), x);  // sin(π-θ)=sin(θ) を用いて -0.25 to 0.25 に折り返す. 0付近の小さな位相は桁落ちしないようそのまま使う
+    Vec4f theta = folded * set1(2.0f * PI_F);
+    Vec4f theta2 = theta * theta;
+    return theta * (a1 + theta2 * (a3 + theta2 * (a5 + theta2 * a7)));
+  }
+
+  /// @brief 分岐なしで sin(2π*phase), cos(2π*phase) を同時に求める. 位相を1/4周期ごとの区間に分け、
+  ///        ±π/4 以内に縮約した角度のsin,cosの多項式(テイラー展開の9次, 8次. 誤差4e-7程度)を区間に応じて入れ替える.
+  ///        0付近の位相ではcosも1からのずれまで正確に求まるので、発振器の回転量のような小さな角度に向く
+  /// @param[in] phase 位相(-0.5以上. 1で1周期)
+  /// @param[out] s sin(2π*phase)
+  /// @param[out] c cos(2π*phase)
+  static inline void sinCosCycle(const Vec4f& phase, Vec4f& s, Vec4f& c) {
+    const Vec4f zero = set1(0.0f);
+    const Vec4f half = set1(0.5f);
+    const Vec4f one = set1(1.0f);
+    const Vec4f oneHalf = set1(1.5f);
+
+    Vec4f x = phase - (phase + half).truncate();  // -0.5 to 0.5 に収める
+    Vec4f q = (x * set1(4.0f) + half).floor();  // 区間の番号(-2 to 2)
+    Vec4f theta = (x - q * set1(0.25f)) * set1(2.0f * PI_F);  // -π/4 to π/4
+    Vec4f theta2 = theta * theta;
+    Vec4f sp = theta * (one + theta2 * (set1(-1.0f/6) + theta2 * (set1(1.0f/120) + theta2 * set1(-1.0f/5040))));
+    Vec4f cp = one + theta2 * (set1(-1.0f/2) + theta2 * (set1(1.0f/24) + theta2 * (set1(-1.0f/720) + theta2 * set1(1.0f/40320))));
+
+    // q=0: (sp, cp), q=±1: (±cp, ∓sp), q=±2: (-sp, -cp)
+    Vec4f aq = q.abs();
+    Vec4f sq = one.copySign(q);
+    s = selectGt(aq, half, selectGt(oneHalf, aq, cp * sq, zero - sp), sp);
+    c = selectGt(aq, half, selectGt(oneHalf, aq, zero - sp * sq, zero - cp), cp);
+  }
+};
+
+/// @brief n個の位相の sin, cos を Vec4f::WIDTH 個ずつまとめて求める.
+///        配列は n を Vec4f::WIDTH の倍数に切り上げた要素数まで読み書きするので、その大きさを確保しておくこと
+/// @param[in] phase 位相(-0.5以上. 1で1周期)
+/// @param[out] s sin(2π*phase)
+/// @param[out] c cos(2π*phase)
+/// @param[in] n 要素数
+inline void sinCosCycleBlock(const float* phase, float* s, float* c, const size_t n) {
+  for (size_t k = 0; k < n; k += Vec4f::WIDTH) {
+    Vec4f vs, vc;
+    Vec4f::sinCosCycle(Vec4f::load(&phase[k]), vs, vc);
+    vs.store(&s[k]);
+    vc.store(&c[k]);
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "constant.h"
+#ifndef ARDUINO_ARCH_ESP32
+#include <math.h>
+#endif
+
+/// @brief 正弦波の計算精度
+typedef enum SinePrecision {
+  SINE_PRECISION_TABLE,  // テーブル参照のみ. 最速だが誤差は最大 2π/TABLE_SIZE 程度
+  SINE_PRECISION_LERP,   // テーブル参照+線形補間. 誤差は最大 (2π/TABLE_SIZE)^2/8 程度
+  SINE_PRECISION_LIBM,   // 標準ライブラリのsin(倍精度). 最も正確だが遅い
+  SINE_PRECISION_NUM
+} SinePrecision;
+
+/// @brief 1周期ぶんの正弦波テーブル. 位相(0 to 1)からsin(2π*位相)を求める.
+///        テーブルは全インスタンスで共有するので、SineTable::instance() から参照を得て使う
+class SineTable {
+ public:
+  static const int TABLE_BITS = 10;
+  static const int TABLE_SIZE = 1 << TABLE_BITS;
+
+  /// @brief 共有のテーブルを取得する. 初回呼び出し時にテーブルが作成される
+  static const SineTable& instance() {
+    static const SineTable table;
+    return table;
+  }
+
+  /// @brief テーブル参照のみでsinを求める
+  /// @param[in] phase 位相(0 to 1)
+  /// @retval sin(2π*phase). (-1 to 1)
+  inline float lookup(const float phase) const {
+    return _table[static_cast<int>(phase * TABLE_SIZE) & (TABLE_SIZE - 1)];
+  }
+
+  /// @brief テーブル参照と線形補間でsinを求める
+  /// @param[in] phase 位相(0 to 1)
+  /// @retval sin(2π*phase). (-1 to 1)
+  inline float lerp(const float phase) const {
+    float x = phase * TABLE_SIZE;
+    int i = static_cast<int>(x);
+    float alpha = x - i;  // 線形補間の位置(0～1)
+    i &= (TABLE_SIZE - 1);
+    return _table[i] + alpha * (_table[i + 1] - _table[i]);
+  }
+
+#ifdef USE_FIXED_POINT
+  /// @brief 固定小数点の位相からテーブル参照と線形補間でsinを求める
+  /// @param[in] phase 位相. 2^32で1周期
+  /// @retval sin(2π*phase/2^32) のQ15表現. (-32767 to 32767)
+  inline int32_t lerpQ15(const uint32_t phase) const {
+    uint32_t i = phase >> (32 - TABLE_BITS);
+    int32_t alpha = (phase >> (32 - TABLE_BITS - 15)) & 0x7FFF;  // 線形補間の位置(Q15)
+    return _tableQ15[i] + (((_tableQ15[i + 1] - _tableQ15[i]) * alpha) >> 15);
+  }
+#endif
+
+  /// @brief 指定された精度でsinを求める
+  /// @param[in] phase 位相(0 to 1)
+  /// @param[in] precision 計算精度
+  /// @retval sin(2π*phase). (-1 to 1)
+  inline float calc(const float phase, const SinePrecision precision) const {
+    switch (precision) {
+    case SINE_PRECISION_TABLE:
+      return lookup(phase);
+    case SINE_PRECISION_LIBM:
+      return sin(2 * PI * phase);
+    default:
+      return lerp(phase);
+    }
+  }
+
+ private:
+  float _table[TABLE_SIZE + 1];  // 線形補間用に、末尾に先頭と同じ値を1つ余分に持つ
+#ifdef USE_FIXED_POINT
+  int32_t _tableQ15[TABLE_SIZE + 1];  // _table のQ15表現
+#endif
+
+  SineTable() {
+    for (int i = 0; i <= TABLE_SIZE; i++) {
+      _table[i] = sin(2 * PI * i / TABLE_SIZE);
+#ifdef USE_FIXED_POINT
+      _tableQ15[i] = static_cast<int32_t>(lround(_table[i] * 32767.0));
+#endif
+    }
+  }
+};
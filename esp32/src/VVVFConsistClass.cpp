@@ -0,0 +1,244 @@
+#include "VVVFConsistClass.h"
+
+const float VVVFConsistClass::SLIP_DEFAULT = 2.0f;
+
+VVVFConsistClass::VVVFConsistClass(const CarDataClass& carData)
+    : _carData(carData), _sineTable(SineTable::instance()), _sinePrecision(SINE_PRECISION_LERP), _controlPeriod(32),
+      _unitNum(1), _volume(0), _randSeed(2463534242u) {
+  for (int u = 0; u < UNIT_MAX; u++) {
+    _slip[u] = SLIP_DEFAULT;
+    _gain[u] = (u < _unitNum) ? 1.0f : 0.0f;
+    _delay[u] = 0;
+  }
+  clear();
+}
+VVVFConsistClass::~VVVFConsistClass() {}
+
+void VVVFConsistClass::clear() {
+  _pmIndex = -1;
+  _Vs = 0.0f;
+  _syncCache.clear();
+
+  for (int u = 0; u < UNIT_MAX; u++) {
+    _random[u].state = _randSeed ^ (0x9E3779B9u * static_cast<uint32_t>(u + 1));  // ユニットごとに異なる種
+    if (_random[u].state == 0) {
+      _random[u].state = 1;  // xorshiftは状態0から抜け出せない
+    }
+    for (int n = 0; n < 4; n++) {
+      _random[u].next();  // 似た種から始めた直後の相関を減らす
+    }
+    _phaseSin[u] = 0.5f * (_random[u].next() + 1.0f);
+    _phaseCarrier[u] = 1.001f + 0.49f * (_random[u].next() + 1.0f);  // 1を超えているので最初のサンプルでfcが計算され、位相は1を引いた値から始まる
+    _fc[u] = 0.0f;
+    _lineV[0][u] = 0.0f;
+    _lineV[1][u] = 0.0f;
+  }
+  for (int n = 0; n < BUS_SIZE; n++) {
+    _bus[0][n] = 0.0f;
+    _bus[1][n] = 0.0f;
+  }
+  _busPos = 0;
+}
+
+int VVVFConsistClass::setVolume(int volume) {
+  if (volume < 0 || volume > 32767) {
+    return 0;
+  }
+  _volume = volume;
+  return 1;
+}
+
+int VVVFConsistClass::setSeed(uint32_t seed) {
+  if (seed == 0) {
+    return 0;  // xorshiftは状態0から抜け出せない
+  }
+  _randSeed = seed;
+  clear();
+  return 1;
+}
+
+int VVVFConsistClass::setSinePrecision(SinePrecision precision) {
+  if (precision < 0 || precision >= SINE_PRECISION_NUM) {
+    return 0;
+  }
+  _sinePrecision = precision;
+  _syncCache.clear();  // テーブルは信号波の計算精度に依存するので作り直す
+  return 1;
+}
+
+int VVVFConsistClass::setControlPeriod(int period) {
+  if (period < 1 || period > PwmControlClass::PERIOD_MAX) {
+    return 0;
+  }
+  _controlPeriod = period;
+  return 1;
+}
+
+int VVVFConsistClass::setUnitNum(int num) {
+  if (num < 1 || num > UNIT_MAX) {
+    return 0;
+  }
+  for (int u = 0; u < UNIT_MAX; u++) {
+    if (u >= num) {
+      _gain[u] = 0.0f;  // 未使用のユニットはVec4fの端数として計算だけされるので、出力を0にしておく
+    } else if (u >= _unitNum) {
+      _slip[u] = SLIP_DEFAULT;
+      _gain[u] = 1.0f;
+      _delay[u] = 0;
+    }
+  }
+  _unitNum = num;
+  return 1;
+}
+
+int VVVFConsistClass::setUnit(int unit, float slip, float gain, int delay) {
+  if (unit < 0 || unit >= _unitNum || delay < 0 || delay >= BUS_SIZE) {
+    return 0;
+  }
+  _slip[unit] = slip;
+  _gain[unit] = gain;
+  _delay[unit] = delay;
+  return 1;
+}
+
+int VVVFConsistClass::generateSound(uint8_t* buf, int size, float* speed) {
+  // speed から fs へ換算する係数. VVVFSoundClass と同じ
+  float coeffSpdToFs = 1.0/3.6 / (PI*_carData._wheelDiameter) * (_carData._largeGear/_carData._smallGear) * _carData._pole/2;
+
+  // PwmControlClass::BLOCK サンプルずつ、制御量を求めてから生成する
+  size_t sampleNum = size / 4;
+  const size_t period = _controlPeriod;
+  const SyncPatternClass* pPattern = nullptr;
+  for (size_t head = 0; head < sampleNum; head += PwmControlClass::BLOCK) {
+    size_t num = (sampleNum - head < PwmControlClass::BLOCK) ? sampleNum - head : PwmControlClass::BLOCK;
+    _control.calc(_carData, speed + head, num, sampleNum - head, coeffSpdToFs, period);
+    for (size_t j = 0; j < num; j++) {
+      // 信号波周波数(すべりを除く), パルスモード, Vs は全ユニットで共通
+      const float fsBase = _control.fs[j] - SLIP_DEFAULT;
+      _Vs = _control.vs[j];
+      int pmIndex = _control.pmIndexAt(j, period);
+      if (pmIndex != _pmIndex) {
+        _pmIndex = pmIndex;
+        pPattern = nullptr;
+      }
+
+      const int mode = (pmIndex >= 0) ? _carData._listMode[pmIndex] : -1;
+      if (mode == ASYNC) {
+        renderAsyncUnits(fsBase);
+      } else if (mode == SYNC || SwitchingAngleClass::isAngleMode(mode)) {
+        // 同期モードも波形テーブルを引く. テーブルはVsだけで決まるので全ユニットで共有できる
+        int vsStep = static_cast<int>(_Vs * SyncPatternClass::VS_STEPS + 0.5f);
+        if (pPattern == nullptr || pPattern->vsStep != vsStep) {
+          pPattern = &_syncCache.get(_carData, pmIndex, vsStep, _syncCarrier, _sineTable, _sinePrecision);
+        }
+        renderPatternUnits(fsBase, *pPattern);
+      } else {
+        // 未対応モード: 信号波位相だけ進め、線間電圧は直前の値を保持する
+        for (int k = 0; k < _unitNum; k += Vec4f::WIDTH) {
+          advancePhaseUnits(k, fsBase);
+        }
+      }
+
+      // 各ユニットの出力を遅延させてミックスバスに足し、現在のサンプルを取り出す
+      for (int u = 0; u < _unitNum; u++) {
+        size_t pos = (_busPos + _delay[u]) & (BUS_SIZE - 1);
+        _bus[0][pos] += _lineV[0][u];
+        _bus[1][pos] += _lineV[1][u];
+      }
+      for (int ch = 0; ch < 2; ch++) {
+        int v = static_cast<int>(_bus[ch][_busPos] * _volume);
+        if (v > 32767) v = 32767;
+        if (v < -32767) v = -32767;
+        *reinterpret_cast<int16_t*>(&buf[4*(head + j) + 2*ch]) = static_cast<int16_t>(v);
+        _bus[ch][_busPos] = 0.0f;
+      }
+      _busPos = (_busPos + 1) & (BUS_SIZE - 1);
+    }
+  }
+  return 1;
+}
+
+/// @brief k番目から Vec4f::WIDTH ユニットぶんの信号波位相をサンプリング時間分進める
+/// @param[in] k 先頭のユニット番号(Vec4f::WIDTH の倍数)
+/// @param[in] fsBase すべりを除いた信号波周波数[Hz]
+/// @retval 進めた後のW相の信号波位相(0 to 1)
+inline Vec4f VVVFConsistClass::advancePhaseUnits(const int k, const float fsBase) {
+  Vec4f fs = Vec4f::set1(fsBase) + Vec4f::load(&_slip[k]);
+  Vec4f p = (Vec4f::load(&_phaseSin[k]) + fs * Vec4f::set1(T_SAMPLE_F)).frac();
+  p.store(&_phaseSin[k]);
+  return p;
+}
+
+/// @brief 非同期モードで全ユニットの1サンプルを計算し、ゲインをかけた線間電圧を _lineV に入れる.
+///        キャリアの位相と3相の比較は Vec4f::WIDTH ユニットずつまとめて行い、キャリア周波数の更新(1周ごと)だけユニットごとに行う
+/// @param[in] fsBase すべりを除いた信号波周波数[Hz]
+inline void VVVFConsistClass::renderAsyncUnits(const float fsBase) {
+  const size_t pmIndex = _pmIndex;
+  const Vec4f vs = Vec4f::set1(_Vs);
+  const Vec4f dt = Vec4f::set1(T_SAMPLE_F);
+  const Vec4f oneThird = Vec4f::set1(1.0f/3.0f);
+  const Vec4f twoThirds = Vec4f::set1(2.0f/3.0f);
+  const Vec4f half = Vec4f::set1(0.5f);
+  const Vec4f one = Vec4f::set1(1.0f);
+  const Vec4f four = Vec4f::set1(4.0f);
+  for (int k = 0; k < _unitNum; k += Vec4f::WIDTH) {
+    Vec4f p = advancePhaseUnits(k, fsBase);
+
+    // キャリアの位相を進め、1周を超えたユニットだけキャリア周波数を再計算する(VVVFSoundClass::calcAsyncTriangle() と同じ)
+    (Vec4f::load(&_phaseCarrier[k]) + Vec4f::load(&_fc[k]) * dt).store(&_phaseCarrier[k]);
+    for (int u = k; u < k + Vec4f::WIDTH; u++) {
+      if (_phaseCarrier[u] > 1.0f) {
+        _phaseCarrier[u] -= 1.0f;
+        float fs = fsBase + _slip[u];
+        float frand = _carData._listFrandSlope[pmIndex] * fs + _carData._listFrandIntercept[pmIndex];
+        _fc[u] = _carData._listFcSlope[pmIndex] * fs + _carData._listFcIntercept[pmIndex] + frand * _random[u].next();
+      }
+    }
+    Vec4f c = one - four * (Vec4f::load(&_phaseCarrier[k]) - half).abs();  // 谷(-1)から始まる三角波
+
+    if (_sinePrecision == SINE_PRECISION_LERP) {
+      Vec4f bU = (vs * Vec4f::sinCycle(p + twoThirds) - c).geZero();
+      Vec4f bV = (vs * Vec4f::sinCycle(p + oneThird) - c).geZero();
+      Vec4f bW = (vs * Vec4f::sinCycle(p) - c).geZero();
+      Vec4f gain = Vec4f::load(&_gain[k]);
+      ((bU - bV) * gain).store(&_lineV[0][k]);
+      ((bV - bW) * gain).store(&_lineV[1][k]);
+    } else {
+      // 指定した精度の信号波はテーブルから求めるので、ユニットごとにスカラで比較する
+      float phaseW[Vec4f::WIDTH], carrier[Vec4f::WIDTH];
+      p.store(phaseW);
+      c.store(carrier);
+      for (int l = 0; l < Vec4f::WIDTH; l++) {
+        float phase[3] = {phaseW[l] + 2.0f/3.0f, phaseW[l] + 1.0f/3.0f, phaseW[l]};
+        phase[0] -= (int)phase[0];
+        phase[1] -= (int)phase[1];
+        int b[3];
+        for (int i_p = 0; i_p < 3; i_p++) {
+          b[i_p] = (_Vs * _sineTable.calc(phase[i_p], _sinePrecision) >= carrier[l]);
+        }
+        _lineV[0][k + l] = (b[0] - b[1]) * _gain[k + l];
+        _lineV[1][k + l] = (b[1] - b[2]) * _gain[k + l];
+      }
+    }
+  }
+}
+
+/// @brief 同期モード・スイッチング角を指定するモードで全ユニットの1サンプルを計算し、ゲインをかけた線間電圧を _lineV に入れる.
+///        信号波位相は Vec4f::WIDTH ユニットずつ進め、相電圧出力は共有の波形テーブルをユニットごとに引く
+/// @param[in] fsBase すべりを除いた信号波周波数[Hz]
+/// @param[in] rPattern 波形テーブル
+inline void VVVFConsistClass::renderPatternUnits(const float fsBase, const SyncPatternClass& rPattern) {
+  const Vec4f twoThirds = Vec4f::set1(2.0f/3.0f);
+  float phaseU[Vec4f::WIDTH];
+  for (int k = 0; k < _unitNum; k += Vec4f::WIDTH) {
+    (advancePhaseUnits(k, fsBase) + twoThirds).frac().store(phaseU);
+    for (int l = 0; l < Vec4f::WIDTH; l++) {
+      uint8_t bits = rPattern.lookup(phaseU[l]);
+      int u = bits & 0x1;
+      int v = (bits >> 1) & 0x1;
+      int w = (bits >> 2) & 0x1;
+      _lineV[0][k + l] = (u - v) * _gain[k + l];
+      _lineV[1][k + l] = (v - w) * _gain[k + l];
+    }
+  }
+}
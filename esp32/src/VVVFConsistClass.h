@@ -0,0 +1,113 @@
+#pragma once
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+#endif
+
+#include "constant.h"
+#include "CarDataClass.h"
+#include "PulsePattern.h"
+#include "PwmControl.h"
+#include "SineTable.h"
+#include "Simd.h"
+
+/// @brief 編成内の複数のVVVFインバータ(ユニット)の音をまとめて生成するクラス.
+///        制御量(信号波周波数・パルスモード・Vs)は VVVFSoundClass と同じく制御周期ごとに求めて全ユニットで共有し、同期モードの波形テーブルも共有する.
+///        ユニットごとに異なる信号波位相・非同期キャリアと3相の比較は Vec4f::WIDTH ユニットずつまとめて計算する.
+///        各ユニットの出力は、ユニットごとのゲインと遅延をかけてミックスバスに足し合わせる.
+///        波形生成方式は VVVFSoundClass の VVVF_ENGINE_COMPARATOR に相当する
+class VVVFConsistClass {
+ private:
+  static const int UNIT_MAX = 8;                    // ユニット数の上限(Vec4f::WIDTHの倍数)
+  static const int BUS_BITS = 12;
+  static const int BUS_SIZE = 1 << BUS_BITS;        // ミックスバスの長さ. 遅延は BUS_SIZE 未満
+  static const float SLIP_DEFAULT;                  // すべり周波数の既定値[Hz]
+
+  const CarDataClass& _carData;
+  const SineTable& _sineTable;
+  SinePrecision _sinePrecision;  // 信号波の計算精度
+  int _controlPeriod;  // 制御量を計算する間隔[サンプル]. 間のサンプルは直線補間する
+  PwmControlClass _control;  // 各サンプルの信号波周波数(すべり SLIP_DEFAULT 込み)・Vsと、各制御点のパルスモード
+  int _unitNum;  // ユニット数
+  int _volume;   // 再生時の音量(0-32767)
+  uint32_t _randSeed;  // 乱数の種. ユニットごとの種はこれから作る
+
+  int _pmIndex;  // 現在のパルスモード. -1のときは未決定
+  float _Vs;     // モータ電圧(全ユニット共通)
+  SyncCarrierClass _syncCarrier;  // 同期モードのキャリア波形(全ユニット共通)
+  SyncPatternCacheClass _syncCache;  // 同期モード・スイッチング角を指定するモードの波形テーブル(全ユニット共通)
+
+  // ユニットごとの設定と状態. Vec4f で読み書きするので UNIT_MAX 個ぶん確保し、未使用のユニットはゲイン0とする
+  float _slip[UNIT_MAX];          // すべり周波数[Hz]
+  float _gain[UNIT_MAX];          // 出力のゲイン
+  int _delay[UNIT_MAX];           // 出力の遅延[サンプル]
+  float _phaseSin[UNIT_MAX];      // W相の信号波位相. U,V相はこれに2/3,1/3周期を足したもの
+  float _phaseCarrier[UNIT_MAX];  // 非同期搬送波の位相
+  float _fc[UNIT_MAX];            // 非同期キャリア周波数(ランダム変調込み)
+  CarrierRandomClass _random[UNIT_MAX];  // キャリア周波数のランダム変調に用いる乱数
+  float _lineV[2][UNIT_MAX];      // ゲインをかけた線間電圧(U-V, V-W). 未対応モードでは直前の値を保持する
+
+  float _bus[2][BUS_SIZE];  // ミックスバス(U-V, V-W). _busPos から先が未来のサンプル
+  size_t _busPos;  // ミックスバス上の現在のサンプルの位置
+
+  inline void renderAsyncUnits(const float fsBase);
+  inline void renderPatternUnits(const float fsBase, const SyncPatternClass& rPattern);
+  inline Vec4f advancePhaseUnits(const int k, const float fsBase);
+
+ public:
+  /// @brief 編成のVVVF音生成クラス
+  /// @param[in] carData 音を鳴らしたい車両の車両データ. 全ユニットで共通
+  VVVFConsistClass(const CarDataClass& carData);
+  ~VVVFConsistClass();
+
+  /// @brief 各ユニットの位相・乱数・ミックスバスを初期状態に戻す. ユニットの設定(setUnit)と音量は保持する.
+  ///        各ユニットの信号波とキャリアの初期位相は、ユニットごとの乱数で互いにずらす
+  void clear();
+
+  /// @brief 音量を設定する
+  /// @param[in] volume 音量(0-32767)
+  /// @retval 1:success, 0:fail
+  int setVolume(int volume);
+
+  /// @brief 乱数の種を設定し、clear() する. ユニットごとの乱数はこの種から作られる
+  /// @param[in] seed 乱数の種. 0は使えない
+  /// @retval 1:success, 0:fail
+  int setSeed(uint32_t seed);
+
+  /// @brief 信号波(正弦波)の計算精度を設定する. 既定値は SINE_PRECISION_LERP.
+  ///        SINE_PRECISION_LERP の場合、非同期モードの3相の比較は同程度の精度の多項式で Vec4f::WIDTH ユニットずつ行う.
+  ///        SINE_PRECISION_TABLE, SINE_PRECISION_LIBM ではユニットごとにスカラで計算する. 同期モードの波形テーブルもこの精度で作成する
+  /// @param[in] precision 計算精度
+  /// @retval 1:success, 0:fail
+  int setSinePrecision(SinePrecision precision);
+
+  /// @brief 信号波周波数・Vs・パルスモードを計算する間隔(制御周期)を設定する. 既定値は32.
+  ///        VVVFSoundClass::setControlPeriod() と同じ
+  /// @param[in] period 制御周期[サンプル](1 to PwmControlClass::PERIOD_MAX)
+  /// @retval 1:success, 0:fail
+  int setControlPeriod(int period);
+
+  /// @brief ユニット数を設定する. 既定値は1. 追加されたユニットはすべり2Hz, ゲイン1, 遅延0で初期化される
+  /// @param[in] num ユニット数(1 to UNIT_MAX)
+  /// @retval 1:success, 0:fail
+  int setUnitNum(int num);
+
+  /// @brief ユニットの設定を変更する
+  /// @param[in] unit ユニット番号(0 to ユニット数-1)
+  /// @param[in] slip すべり周波数[Hz]. 信号波周波数は走行速度から換算した値にこれを足したもの. パルスモードとVsは全ユニットで2Hzとして決める
+  /// @param[in] gain 出力のゲイン
+  /// @param[in] delay 出力の遅延[サンプル](0 to BUS_SIZE-1)
+  /// @retval 1:success, 0:fail
+  int setUnit(int unit, float slip, float gain, int delay);
+
+  /// @brief ある速度における音データをsize[bytes]ぶん生成する. 全ユニットの出力を足し合わせ、int16の範囲に収める.
+  ///        PwmControlClass::BLOCK サンプルごとに制御量を求めてから生成する
+  /// @param[out] buf 生成したPCMデータが格納されるバッファへのポインタ
+  /// @param[in] size 生成する音データのサイズ(bytes). サンプル数は size/4 個になる
+  /// @param[in] speed 各サンプリング点における走行速度[km/h]を size/4 個ぶん格納した配列
+  /// @retval 1:success, 0:fail
+  int generateSound(uint8_t* buf, int size, float* speed);
+};
@@ -5,13 +5,16 @@
 #endif
 #include "Filter.h"
 
-VVVFSoundClass::VVVFSoundClass(const CarDataClass& carData) : _carData(carData) {
+VVVFSoundClass::VVVFSoundClass(const CarDataClass& carData)
+    : _carData(carData), _sineTable(SineTable::instance()), _sinePrecision(SINE_PRECISION_LERP),
+      _controlPeriod(32), _oversampling(1), _decimatorStageNum(0), _dt(T_SAMPLE), _randSeed(2463534242u),
+      _isMotorCurrentEnabled(false), _engine(VVVF_ENGINE_COMPARATOR), _spectralPartialNum(32), _isSyncCacheEnabled(true) {
   clear();
 }
 VVVFSoundClass::~VVVFSoundClass() {}
 
 void VVVFSoundClass::clear() {
-  _pmIndex[0] = 0;
+  _pmIndex = 0;
 
   _Vs = 0.0;
   _phaseSin[0] = 0.0;  _phaseSin[1] = 0.0;  _phaseSin[2] = 0.0;
@@ -20,14 +23,40 @@ void VVVFSoundClass::clear() {
   _fc = 0.0;
   _frand = 0.0;
   _fdeviation = 0.0;
+  _random.state = _randSeed;
   _phaseCarrier = 1.001;  // 初回のcalcAsyncTriangleでfcを更新するために、1より大きい値に初期化しておく
   _ampCarrier = 0.0;
 
+  _diff[0] = 0.0;  _diff[1] = 0.0;  _diff[2] = 0.0;
   _invPhaseV[0] = 0;  _invPhaseV[1] = 0;  _invPhaseV[2] = 0;
   _invLineV[0] = 0;  _invLineV[1] = 0;  _invLineV[2] = 0;
   _firstLPF0.clear(0.0);
   _firstLPF1.clear(0.0);
   _volume = 0;
+  _motorCurrent[0].clear(0.0);
+  _motorCurrent[1].clear(0.0);
+  _motorCurrentHPF[0].clear(0.0);
+  _motorCurrentHPF[1].clear(0.0);
+  for (int st = 0; st < OVERSAMPLING_STAGE_MAX; st++) {
+    _decimator[st][0].clear(0.0);
+    _decimator[st][1].clear(0.0);
+  }
+#ifdef USE_FIXED_POINT
+  _phaseSinQ = 0;
+  _phaseCarrierQ = 0;
+  _incCarrierQ = 0;  // 初回の renderAsyncFixed で fc を計算させる
+  _ampCarrierQ = 0;
+  _VsQ = 0;
+#endif
+  _syncCache.clear();
+  clearBlep();
+  _syncCarrier.Npulse = 0;
+  _specNum = 0;
+  _specPmIndex = -1;
+  for (int j = 0; j < SPECTRAL_PARTIAL_MAX; j++) {
+    _specM[j] = 0.0f;  // 成分数の端数も Vec4f でまとめて読むので、未使用の成分も0にしておく
+    _specN[j] = 0.0f;
+  }
 }
 
 int VVVFSoundClass::setVolume(int volume) {
@@ -38,6 +67,119 @@ int VVVFSoundClass::setVolume(int volume) {
   return 1;
 }
 
+int VVVFSoundClass::setSeed(uint32_t seed) {
+  if (seed == 0) {
+    return 0;  // xorshiftは状態0から抜け出せない
+  }
+  _randSeed = seed;
+  _random.state = seed;
+  return 1;
+}
+
+int VVVFSoundClass::setSinePrecision(SinePrecision precision) {
+  if (precision < 0 || precision >= SINE_PRECISION_NUM) {
+    return 0;
+  }
+  _sinePrecision = precision;
+  _syncCache.clear();  // テーブルは信号波の計算精度に依存するので作り直す
+  _specPmIndex = -1;
+  return 1;
+}
+
+int VVVFSoundClass::setEngine(VVVFEngine engine) {
+  if (engine < 0 || engine >= VVVF_ENGINE_NUM) {
+    return 0;
+  }
+#ifdef USE_FIXED_POINT
+  if (engine != VVVF_ENGINE_COMPARATOR) {
+    return 0;  // 固定小数点版は比較器方式のみ
+  }
+#endif
+  _engine = engine;
+  clearBlep();
+  return 1;
+}
+
+int VVVFSoundClass::setSpectralPartialNum(int num) {
+  if (num < 1 || num > SPECTRAL_PARTIAL_MAX) {
+    return 0;
+  }
+  _spectralPartialNum = num;
+  _specPmIndex = -1;  // 成分の一覧を作り直す
+  return 1;
+}
+
+int VVVFSoundClass::setOversampling(int factor) {
+  int stageNum = 0;
+  switch (factor) {
+  case 1: stageNum = 0; break;
+  case 2: stageNum = 1; break;
+  case 4: stageNum = 2; break;
+  case 8: stageNum = 3; break;
+  default:
+    return 0;
+  }
+#ifdef USE_FIXED_POINT
+  if (factor != 1) {
+    return 0;  // 固定小数点版はオーバーサンプリングに対応しない
+  }
+#endif
+  _oversampling = factor;
+  _decimatorStageNum = stageNum;
+  _dt = T_SAMPLE / factor;
+
+  // 最終段(44.1kHzを出力する段)は急峻に、それより前の段は通過域と阻止域の間が広いので短くする
+  static const int STAGE_TAPS[OVERSAMPLING_STAGE_MAX] = {47, 23, 15};  // 最終段から数えた各段のタップ数
+  for (int st = 0; st < stageNum; st++) {
+    int taps = STAGE_TAPS[stageNum - 1 - st];
+    _decimator[st][0].setTaps(taps);
+    _decimator[st][1].setTaps(taps);
+  }
+  return 1;
+}
+
+int VVVFSoundClass::setSyncCacheEnabled(bool isEnabled) {
+  _isSyncCacheEnabled = isEnabled;
+  return 1;
+}
+
+int VVVFSoundClass::setControlPeriod(int period) {
+  if (period < 1 || period > CONTROL_PERIOD_MAX) {
+    return 0;
+  }
+  _controlPeriod = period;
+  return 1;
+}
+
+int VVVFSoundClass::setMotorCurrentEnabled(bool isEnabled) {
+#ifdef USE_FIXED_POINT
+  if (isEnabled) {
+    return 0;  // 固定小数点版は電流モデルに対応しない
+  }
+#endif
+  if (isEnabled) {
+    const float L = _carData._motorInductance;
+    const float R = _carData._motorResistance;
+    if (L <= 0.0f || R <= 0.0f) {
+      return 0;
+    }
+    // 入力をサンプル間一定とみなした厳密解 i[n] = a*i[n-1] + (1-a)/R*x[n] に、正規化のため基準周波数でのリアクタンスをかける.
+    // RL回路の低域のゲインは ωL/R (数百倍)に達し、誘起電圧の差し引き残りや直流分が出力を飽和させるので、後段のHPFで
+    // MOTOR_CURRENT_REF_FREQ / MOTOR_CURRENT_HPF_FREQ 倍に抑える. 基準周波数でのHPFの減衰ぶんは b で補う
+    const float fRatio = static_cast<float>(MOTOR_CURRENT_HPF_FREQ) / MOTOR_CURRENT_REF_FREQ;
+    float a = exp(-R * T_SAMPLE / L);
+    float b = (1.0f - a) / R * (2.0f * PI_F * MOTOR_CURRENT_REF_FREQ * L) * sqrtf(1.0f + fRatio * fRatio);
+    for (int i_line = 0; i_line < 2; i_line++) {
+      _motorCurrent[i_line].setCoeff(a, b);
+      _motorCurrent[i_line].clear(0.0);
+      _motorCurrentHPF[i_line].setTau(1.0f / (2.0f * PI_F * MOTOR_CURRENT_HPF_FREQ));
+      _motorCurrentHPF[i_line].clear(0.0);
+    }
+  }
+  _isMotorCurrentEnabled = isEnabled;
+  return 1;
+}
+
 int VVVFSoundClass::setCutoffFreq(float fcutoff) {
   if (fcutoff <= 0.0) {
     return 0;
@@ -51,111 +193,1269 @@ int VVVFSoundClass::generateSound(uint8_t* buf, int size, float* speed) {
   // speed から fs へ換算する係数
   float coeffSpdToFs = 1.0/3.6 / (PI*_carData._wheelDiameter) * (_carData._largeGear/_carData._smallGear) * _carData._pole/2;
 
-  // size/4個分のサンプルを生成する
-  for (size_t i = 0; i < size / 4; i++) {
-    float fs = speed[i] * coeffSpdToFs + 2.0;  // すべり周波数として2.0を付加
+  // CONTROL_BLOCK サンプルずつ、制御量を求めてから波形を生成する
+  size_t sampleNum = size / 4;
+  for (size_t head = 0; head < sampleNum; head += CONTROL_BLOCK) {
+    size_t num = (sampleNum - head < CONTROL_BLOCK) ? sampleNum - head : CONTROL_BLOCK;
+    calcControl(speed + head, num, sampleNum - head, coeffSpdToFs);
+    float phaseStart = _phaseSin[2];
+    renderBlock(buf + 4*head, num);
+    if (_isMotorCurrentEnabled) {
+      applyMotorCurrent(buf + 4*head, num, phaseStart);
+    }
+  }
+  return 1;
+}
 
-    // 信号波位相を計算
-    _phaseSin[2] += fs * T_SAMPLE;  // 位相をサンプリング時間分進める
-    _phaseSin[1] = _phaseSin[2] + 1.0/3.0;
-    _phaseSin[0] = _phaseSin[2] + 2.0/3.0;
-    _phaseSin[0] -= (int)_phaseSin[0];  // 整数部を引いて0から1に収める
-    _phaseSin[1] -= (int)_phaseSin[1];
-    _phaseSin[2] -= (int)_phaseSin[2];
+/// @brief 制御周期(_controlPeriod)ごとに走行速度から信号波周波数・信号波電圧・パルスモードを求める.
+///        制御点の間のサンプルの信号波周波数と信号波電圧は、次の制御点の値へ向けて直線補間する
+/// @param[in] speed このブロックの先頭からの走行速度[km/h]の配列
+/// @param[in] num ブロックのサンプル数(CONTROL_BLOCK以下)
+/// @param[in] remain speed の有効な要素数(num以上). 最後の制御点の補間の終点を次のブロックから取るために用いる
+/// @param[in] coeffSpdToFs speed から fs へ換算する係数
+/// @retval None (_control, _ctrlEmf が更新される)
+void VVVFSoundClass::calcControl(const float* speed, size_t num, size_t remain, float coeffSpdToFs) {
+  const size_t period = _controlPeriod;
+  _control.calc(_carData, speed, num, remain, coeffSpdToFs, period);
+  if (_isMotorCurrentEnabled) {
+    for (size_t c = 0; c < num; c += period) {
+      _ctrlEmf[c / period] = calcFundamental(_control.pmIndexAt(c, period), _control.vs[c]);
+    }
+  }
+}
 
-    // 信号波電圧を計算
-    if (fs > _carData._modulationMaxFreq) {
-      _Vs = _carData._modulationMax;  // 最大電圧に達する周波数を超えている場合
-    } else {
-      _Vs = 0.03 + 0.97 * _carData._modulationMax * fs / _carData._modulationMaxFreq;  // V/f一定で上昇.ブーストを3%とる
-    }
-
-    // 現在の周波数におけるパルスモードを取得
-	  size_t pmIndexRef = getPulsemodeIndex(fs);
-
-    // U,V,Wの各相について、パルスモードを変更
-    for (size_t i_p = 0; i_p < 3; i_p++) {
-		
-      // 現在のパルスモードが、現在の周波数において適用されるべきパルスモードと異なるとき(変更が必要)
-      if (_pmIndex[i_p] != pmIndexRef) {
-        // async -> async で変化するとき
-        if (_carData._listMode[_pmIndex[i_p]] == ASYNC && _carData._listMode[pmIndexRef] == ASYNC) {
-          _pmIndex[i_p] = pmIndexRef;  // すぐにパルスモードを変更
-        // syncが絡むとき
-        } else {
-          // if (_phaseSin[i_p] < 1.0/360.0) {  // 信号波位相が0に近いときに限り変更
-            _pmIndex[i_p] = pmIndexRef;
-          // }
-        }
+/// @brief calcControl() で求めた制御量から、1ブロックぶんの波形を生成する.
+///        ブロックはパルスモードが一定の区間(制御点で区切られる)ごとに分け、各区間はモード専用のループで計算する
+/// @param[out] buf このブロックの先頭サンプルを指す出力バッファ
+/// @param[in] num ブロックのサンプル数
+void VVVFSoundClass::renderBlock(uint8_t* buf, size_t num) {
+  size_t begin = 0;
+  while (begin < num) {
+    // 区間先頭の制御点のパルスモードが続く区間の終端を求める
+    const size_t pmPrev = _pmIndex;
+    _pmIndex = _control.pmIndex[begin / _controlPeriod];
+    if (_pmIndex != pmPrev) {
+      _blepPiece = -1;  // VVVF_ENGINE_BLEP のキャリアの区間はパルスモードが変わったら求め直す
+    }
+    size_t end = findSegmentEnd(begin, num);
+    const int mode = currentMode();
+    if (mode == SYNC && _carData._listNpulse[_pmIndex] != _syncCarrier.Npulse) {
+      _syncCarrier.setup(_carData._listNpulse[_pmIndex]);  // キャリア波形はパルスモードが変わったときだけ作り直す
+    }
+
+    // 区間内はモード専用のループで計算する
+#ifdef USE_FIXED_POINT
+    // 固定小数点版は比較器方式のみ
+    switch (mode) {
+    case ASYNC:
+      renderAsyncFixed(buf, begin, end);  break;
+    case SYNC:
+      renderSyncFixed(buf, begin, end);  break;
+    case SYNC_W3P:
+    case SYNC_1P:
+    case SYNC_ANGLE:
+      renderSyncCachedFixed(buf, begin, end);  break;
+    default:
+      renderHoldFixed(buf, begin, end);  break;
+    }
+#else
+    if (_engine == VVVF_ENGINE_SPECTRAL && (mode == ASYNC || mode == SYNC || SwitchingAngleClass::isAngleMode(mode))) {
+      renderSpectral(buf, begin, end);
+      begin = end;
+      continue;
+    }
+    if (_oversampling > 1) {
+      renderOversampled(buf, begin, end);
+      begin = end;
+      continue;
+    }
+
+    // 比較器方式ではSIMDカーネルを用いる. SIMDカーネルの信号波は SINE_PRECISION_LERP 相当の多項式なので、他の精度はスカラで計算する.
+    // BLEPはキャリアの区間ごとにスイッチング時刻を求めるので、サンプルごとの比較は行わない
+    bool useSimd = (_engine == VVVF_ENGINE_COMPARATOR && _sinePrecision == SINE_PRECISION_LERP);
+    switch (mode) {
+    case ASYNC:
+      if (_engine == VVVF_ENGINE_BLEP) {
+        renderAsyncBlep(buf, begin, end);
+      } else if (useSimd) {
+        renderAsyncSimd(buf, begin, end);
+      } else {
+        renderAsync(buf, begin, end);
+      }
+      break;
+    case SYNC:
+      if (_engine == VVVF_ENGINE_BLEP) {
+        renderSyncBlep(buf, begin, end);
+      } else if (_isSyncCacheEnabled) {
+        renderSyncCached(buf, begin, end);
+      } else if (useSimd) {
+        renderSyncSimd(buf, begin, end);
+      } else {
+        renderSync(buf, begin, end);
       }
+      break;
+    case SYNC_W3P:
+    case SYNC_1P:
+    case SYNC_ANGLE:
+      renderSyncCached(buf, begin, end);  break;  // スイッチング角から作った波形テーブルを引く
+    default:
+      renderHold(buf, begin, end);  break;
+    }
+#endif
+    begin = end;
+  }
+}
+
+/// @brief 現在のパルスモード(_pmIndex)の変調方式を取得する
+/// @retval _listMode の値. 該当するパルスモードがない場合は -1 (出力を保持する)
+inline int VVVFSoundClass::currentMode() const {
+  return (_pmIndex == PM_INDEX_NONE) ? -1 : _carData._listMode[_pmIndex];
+}
+
+/// @brief 現在のパルスモード(_pmIndex)が続く区間の終端を求める. パルスモードは制御点でのみ変化する
+/// @param[in] begin 区間の先頭のサンプル番号(制御点)
+/// @param[in] num ブロックのサンプル数
+/// @retval パルスモードが変化する最初の制御点のサンプル番号. 変化しない場合は num
+size_t VVVFSoundClass::findSegmentEnd(size_t begin, size_t num) {
+  const size_t period = _controlPeriod;
+  for (size_t c = begin + period; c < num; c += period) {
+    if (_control.pmIndex[c / period] != _pmIndex) {
+      return c;
     }
+  }
+  return num;
+}
+
+/// @brief 非同期モードの区間を生成する
+void VVVFSoundClass::renderAsync(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  for (size_t i = begin; i < end; i++) {
+    float fs = _control.fs[i];
+    advancePhase(fs);
+    _Vs = _control.vs[i];
+    calcAsyncTriangle(fs, pmIndex);
+    asyncPWM(0);
+    asyncPWM(1);
+    asyncPWM(2);
+    writeSample(buf, i);
+  }
+}
+
+/// @brief 同期モードの区間を生成する. キャリアはU相の信号波位相から決まり3相で共通なので、1サンプルにつき1回だけ計算する
+void VVVFSoundClass::renderSync(uint8_t* buf, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    float fs = _control.fs[i];
+    advancePhase(fs);
+    _Vs = _control.vs[i];
+    calcSyncCarrier(_phaseSin[0]);
+    syncPWM(0);
+    syncPWM(1);
+    syncPWM(2);
+    writeSample(buf, i);
+  }
+}
+
+/// @brief VVVF_ENGINE_BLEP で非同期モードの区間を生成する. キャリアの上り・下りの区間に入るたびに、区間内の各相のスイッチング時刻を
+///        信号波との交点として求めておくので、サンプルごとには信号波とキャリアを比較しない
+void VVVFSoundClass::renderAsyncBlep(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  const float dt = static_cast<float>(_dt);
+  size_t i = begin;
+  while (i < end) {
+    float fs = _control.fs[i];
+    advancePhase(fs);
+    _Vs = _control.vs[i];
+    const float incPrev = _fc * dt;  // 直前のサンプルからのキャリア位相の増分(折り返しで _fc が更新される前の値)
+    calcAsyncTriangle(fs, pmIndex);
 
-    // 非同期の相が1つ以上ある場合、非同期キャリアを計算
-    for (size_t i_p = 0; i_p < 3; i_p++) {
-      if (_carData._listMode[_pmIndex[i_p]] == ASYNC) {
-        calcAsyncTriangle(fs, _pmIndex[i_p]);
-        break;
+    float lineV[2] = {0.0f, 0.0f};
+    applyDueBlepEdges(lineV);
+    const int piece = (_phaseCarrier < 0.5f) ? 0 : 1;
+    const float pieceEnd = piece ? 1.0f : 0.5f;
+    const float tEnd = (pieceEnd - _phaseCarrier) / (_fc * dt);
+    if (piece != _blepPiece) {
+      if (_blepPiece < 0) {
+        startBlepPiece(_ampCarrier, (piece ? -4.0f : 4.0f) * _fc * dt, 0.0f, tEnd, fs * dt, lineV);
+      } else {
+        // 区間の始点(キャリアの山・谷)は直前のサンプルとの間にある
+        const float tStart = -(_phaseCarrier - (pieceEnd - 0.5f)) / incPrev;
+        startBlepPiece(piece ? 1.0f : -1.0f, (piece ? -2.0f : 2.0f) / (tEnd - tStart), tStart, tEnd, fs * dt, lineV);
       }
+      _blepPiece = piece;
     }
+    outputBlep(buf, i, lineV);
+    i++;
+
+    i = renderBlepInside(buf, i, end, tEnd, true);
+  }
+  finishBlep();
+}
 
-    // 各相について、非同期または同期PWMを行う
-    for (size_t i_p = 0; i_p < 3; i_p++) {
-      switch (_carData._listMode[_pmIndex[i_p]]) {
-      case ASYNC:  // 非同期PWM
-        asyncPWM(i_p);  break;
-      case SYNC:
-        syncPWM(i_p);  break;
-      
-      default:
-        break;
+/// @brief VVVF_ENGINE_BLEP で同期モードの区間を生成する. キャリアはU相の信号波位相について折れ線なので、
+///        折れ線の各区間に入るたびに、区間内の各相のスイッチング時刻を信号波との交点として求めておく
+void VVVFSoundClass::renderSyncBlep(uint8_t* buf, size_t begin, size_t end) {
+  const int pieceNum = 2 * _syncCarrier.repeat * _syncCarrier.bumpNum;  // 信号波1周期あたりの区間の数. 山・谷それぞれの前半と後半
+  const float pieceWidth = 1.0f / pieceNum;
+  const float dt = static_cast<float>(_dt);
+  size_t i = begin;
+  while (i < end) {
+    float fs = _control.fs[i];
+    advancePhase(fs);
+    _Vs = _control.vs[i];
+
+    float lineV[2] = {0.0f, 0.0f};
+    applyDueBlepEdges(lineV);
+    const float dPhase = fs * dt;
+    const float x = _phaseSin[0] * pieceNum;  // 区間の幅を1とした位相. 区間の番号と始点からの位相を同じ値から求め、丸めによる食い違いを防ぐ
+    int piece = static_cast<int>(x);
+    if (piece >= pieceNum) {
+      piece = pieceNum - 1;
+    }
+    if (dPhase <= 0.0f) {
+      _blepPiece = -1;  // 信号波が進まない間は区間を追わず、進み始めたら求め直す
+    } else if (_blepPiece < 0 || _blepPiece >= pieceNum) {
+      int sign = _syncCarrier.bumpSign[(piece / 2) % _syncCarrier.bumpNum];
+      float slope = ((piece & 1) ? -sign : sign) * pieceNum * dPhase;
+      startBlepPiece(_syncCarrier.calc(_phaseSin[0]), slope, 0.0f, ((piece + 1) * pieceWidth - _phaseSin[0]) / dPhase, dPhase, lineV);
+      _blepPiece = piece;
+    } else {
+      // 1サンプルの間に複数の区間を過ぎた場合も、順に求める
+      while (_blepPiece != piece) {
+        int next = (_blepPiece + 1 < pieceNum) ? _blepPiece + 1 : 0;
+        int sign = _syncCarrier.bumpSign[(next / 2) % _syncCarrier.bumpNum];
+        float d = x - next;  // 区間の始点からの位相(区間の幅を1とする)
+        if (d < 0.0f) {
+          d += pieceNum;
+        }
+        float tStart = -d * pieceWidth / dPhase;
+        float slope = ((next & 1) ? -sign : sign) * pieceNum * dPhase;
+        startBlepPiece((next & 1) ? sign : 0.0f, slope, tStart, tStart + pieceWidth / dPhase, dPhase, lineV);
+        _blepPiece = next;
       }
     }
+    outputBlep(buf, i, lineV);
+    i++;
 
-    // printf("fs:%f, phaseSin[0]:%f, Vs:%f, pmIndex[0]:%d, fc:%f, phaseCarrier:%f, ampCarrier:%f\n", fs[i], _phaseSin[0], _Vs, _pmIndex[0], _fc, _phaseCarrier, _ampCarrier);
+    if (dPhase > 0.0f) {
+      i = renderBlepInside(buf, i, end, (_blepPiece + 1 - x) / (pieceNum * dPhase), false);
+    }
+  }
+  finishBlep();
+}
 
-    // 出力先アドレスを出力バッファの適切な位置に指定
-    int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*i]);
-    int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*i+2]);
-    // 線間電圧を計算
+/// @brief オーバーサンプリングして区間を生成する. 1出力サンプルあたり _oversampling 回PWMを計算し、
+///        線間電圧をデシメータに通して出力する. 走行速度は1出力サンプルの間一定とみなす
+void VVVFSoundClass::renderOversampled(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  const int mode = currentMode();
+  const bool useTable = SwitchingAngleClass::isAngleMode(mode) || (mode == SYNC && _isSyncCacheEnabled);
+  float lineV[2][OVERSAMPLING_MAX];  // 1出力サンプルぶんの線間電圧
+
+  for (size_t i = begin; i < end; i++) {
+    float fs = _control.fs[i];
+    _Vs = _control.vs[i];
+    const SyncPatternClass* pPattern = nullptr;
+    if (useTable) {
+      pPattern = &getSyncPattern(pmIndex, static_cast<int>(_Vs * SYNC_VS_STEPS + 0.5f));
+    }
+
+    for (int j = 0; j < _oversampling; j++) {
+      advancePhase(fs);
+      if (pPattern != nullptr) {
+        uint8_t bits = pPattern->lookup(_phaseSin[0]);
+        _invPhaseV[0] = bits & 0x1;
+        _invPhaseV[1] = (bits >> 1) & 0x1;
+        _invPhaseV[2] = (bits >> 2) & 0x1;
+      } else if (mode == ASYNC) {
+        calcAsyncTriangle(fs, pmIndex);
+        asyncPWM(0);
+        asyncPWM(1);
+        asyncPWM(2);
+      } else if (mode == SYNC) {
+        calcSyncCarrier(_phaseSin[0]);
+        syncPWM(0);
+        syncPWM(1);
+        syncPWM(2);
+      }
+      lineV[0][j] = static_cast<float>(_invPhaseV[0] - _invPhaseV[1]);
+      lineV[1][j] = static_cast<float>(_invPhaseV[1] - _invPhaseV[2]);
+    }
     _invLineV[0] = _invPhaseV[0] - _invPhaseV[1];
     _invLineV[1] = _invPhaseV[1] - _invPhaseV[2];
-    // _invLineV[2] = _invPhaseV[2] - _invPhaseV[0];
+
+    int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*i]);
+    int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*i+2]);
+    *pResultL = static_cast<int16_t>(decimate(lineV[0], 0) * _volume);
+    *pResultR = static_cast<int16_t>(decimate(lineV[1], 1) * _volume);
+  }
+}
+
+/// @brief _oversampling 個の入力をデシメータの各段に通して1サンプルにする
+/// @param[in,out] x 入力(_oversampling 個). 計算途中の値で上書きされる
+/// @param[in] i_line 線間電圧の番号(0:U-V, 1:V-W)
+/// @retval 出力
+inline float VVVFSoundClass::decimate(float* x, const size_t i_line) {
+  int n = _oversampling;
+  for (int st = 0; st < _decimatorStageNum; st++) {
+    n /= 2;
+    for (int k = 0; k < n; k++) {
+      x[k] = _decimator[st][i_line].process(x[2*k], x[2*k + 1]);
+    }
+  }
+  return x[0];
+}
+
+/// @brief 非同期モードの区間を、SIMDカーネルを用いて生成する.
+///        信号波位相とキャリアは逐次的に決まるのでスカラで SIMD_BLOCK サンプルぶん求め、Vsと3相の比較をまとめて行う
+void VVVFSoundClass::renderAsyncSimd(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  float phase[SIMD_BLOCK], vs[SIMD_BLOCK], carrier[SIMD_BLOCK];
+  for (size_t b = begin; b < end; b += SIMD_BLOCK) {
+    size_t num = (end - b < SIMD_BLOCK) ? end - b : SIMD_BLOCK;
+    for (size_t k = 0; k < num; k++) {
+      const float fs = _control.fs[b + k];
+      _phaseSin[2] += fs * (float)_dt;  // W相の位相のみ進める. 1を超えた分はブロックの最後にまとめて戻す
+      phase[k] = _phaseSin[2];
+      vs[k] = _control.vs[b + k];
+      calcAsyncTriangle(fs, pmIndex);
+      carrier[k] = _ampCarrier;
+    }
+    finishBlockSimd(num, phase, vs, carrier);
+    comparePhasesSimd(buf, b, num, phase, vs, carrier);
+  }
+}
+
+/// @brief 同期モードの区間を、SIMDカーネルを用いて生成する. キャリアが通常の三角波の場合はキャリアもSIMDで計算する
+void VVVFSoundClass::renderSyncSimd(uint8_t* buf, size_t begin, size_t end) {
+  const bool isTriangle = _syncCarrier.isTriangle;
+  float phase[SIMD_BLOCK], vs[SIMD_BLOCK], carrier[SIMD_BLOCK];
+  for (size_t b = begin; b < end; b += SIMD_BLOCK) {
+    size_t num = (end - b < SIMD_BLOCK) ? end - b : SIMD_BLOCK;
+    for (size_t k = 0; k < num; k++) {
+      _phaseSin[2] += _control.fs[b + k] * (float)_dt;  // W相の位相のみ進める. 1を超えた分はブロックの最後にまとめて戻す
+      phase[k] = _phaseSin[2];
+      vs[k] = _control.vs[b + k];
+      if (!isTriangle) {
+        float phaseU = phase[k] + 2.0f/3.0f;
+        phaseU -= (int)phaseU;
+        carrier[k] = _syncCarrier.calc(phaseU);
+      }
+    }
+    finishBlockSimd(num, phase, vs, carrier);
+    size_t numVec = (num + Vec4f::WIDTH - 1) / Vec4f::WIDTH * Vec4f::WIDTH;
+    if (isTriangle) {
+      // SyncCarrierClass::calc() と同じ波形を分岐なしで求める. q=frac(キャリア位相+1/4) とすると 4|q-1/2|-1
+      const Vec4f n = Vec4f::set1(static_cast<float>(_syncCarrier.repeat));
+      const Vec4f twoThirds = Vec4f::set1(2.0f/3.0f);
+      const Vec4f quarter = Vec4f::set1(0.25f);
+      const Vec4f half = Vec4f::set1(0.5f);
+      const Vec4f four = Vec4f::set1(4.0f);
+      const Vec4f one = Vec4f::set1(1.0f);
+      for (size_t k = 0; k < numVec; k += Vec4f::WIDTH) {
+        Vec4f phaseU = (Vec4f::load(&phase[k]) + twoThirds).frac();
+        Vec4f q = ((phaseU * n).frac() + quarter).frac();
+        (four * (q - half).abs() - one).store(&carrier[k]);
+      }
+      _ampCarrier = carrier[num - 1];
+    }
+    comparePhasesSimd(buf, b, num, phase, vs, carrier);
+  }
+}
+
+/// @brief SIMDカーネル用に1ブロックぶんの入力を求めた後の処理. 信号波位相を0から1に戻してU,V相の位相を更新し、
+///        配列の num 以降(Vec4f::WIDTH の倍数に満たない端数)を最後の値で埋める.
+///        ブロック内の phase は1を超えていてもよい(カーネル内で小数部をとる)
+inline void VVVFSoundClass::finishBlockSimd(size_t num, float* phase, float* vs, float* carrier) {
+  _phaseSin[2] -= (int)_phaseSin[2];
+  _phaseSin[1] = _phaseSin[2] + 1.0f/3.0f;
+  _phaseSin[0] = _phaseSin[2] + 2.0f/3.0f;
+  _phaseSin[0] -= (int)_phaseSin[0];
+  _phaseSin[1] -= (int)_phaseSin[1];
+  _Vs = vs[num - 1];
+  size_t numVec = (num + Vec4f::WIDTH - 1) / Vec4f::WIDTH * Vec4f::WIDTH;
+  for (size_t k = num; k < numVec; k++) {
+    phase[k] = phase[num - 1];
+    vs[k] = vs[num - 1];
+    carrier[k] = carrier[num - 1];
+  }
+}
+
+/// @brief 3相ぶんの信号波計算・キャリアとの比較・線間電圧の計算を、Vec4f::WIDTH サンプルずつまとめて行い、出力バッファに書き込む
+/// @param[out] buf 出力バッファ
+/// @param[in] begin 書き込む先頭のサンプル番号
+/// @param[in] num サンプル数(SIMD_BLOCK以下). 入力配列は Vec4f::WIDTH の倍数の要素数まで有効な値で埋めておくこと
+/// @param[in] phase 各サンプルにおけるW相の信号波位相(0 to 1). U,V相はこれより2/3,1/3周期進んでいる
+/// @param[in] vs 各サンプルにおける信号波電圧
+/// @param[in] carrier 各サンプルにおけるキャリアの瞬時値
+void VVVFSoundClass::comparePhasesSimd(uint8_t* buf, size_t begin, size_t num, const float* phase, const float* vs, const float* carrier) {
+  float lineV0[SIMD_BLOCK], lineV1[SIMD_BLOCK];
+  float diffU[SIMD_BLOCK], diffV[SIMD_BLOCK], diffW[SIMD_BLOCK];
+  const Vec4f oneThird = Vec4f::set1(1.0f/3.0f);
+  const Vec4f twoThirds = Vec4f::set1(2.0f/3.0f);
+
+  // 端数は計算だけ行い、書き込まない(入力は finishBlockSimd で Vec4f::WIDTH の倍数まで埋めてある)
+  size_t numVec = (num + Vec4f::WIDTH - 1) / Vec4f::WIDTH * Vec4f::WIDTH;
+
+  for (size_t k = 0; k < numVec; k += Vec4f::WIDTH) {
+    Vec4f p = Vec4f::load(&phase[k]);
+    Vec4f v = Vec4f::load(&vs[k]);
+    Vec4f c = Vec4f::load(&carrier[k]);
+    Vec4f dU = v * Vec4f::sinCycle(p + twoThirds) - c;
+    Vec4f dV = v * Vec4f::sinCycle(p + oneThird) - c;
+    Vec4f dW = v * Vec4f::sinCycle(p) - c;
+    Vec4f bU = dU.geZero();
+    Vec4f bV = dV.geZero();
+    Vec4f bW = dW.geZero();
+    (bU - bV).store(&lineV0[k]);
+    (bV - bW).store(&lineV1[k]);
+    dU.store(&diffU[k]);
+    dV.store(&diffV[k]);
+    dW.store(&diffW[k]);
+  }
+
+  for (size_t k = 0; k < num; k++) {
     // 出力(LPFを通さない方が、ジョイント音と合わせた際に綺麗)
-    *pResultL = _invLineV[0] * _volume;  //_firstLPF0.update(_invLineV[0] * _volume, T_SAMPLE);
-    *pResultR = _invLineV[1] * _volume;  // _firstLPF1.update(_invLineV[1] * _volume, T_SAMPLE);
+    int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*(begin + k)]);
+    int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*(begin + k)+2]);
+    *pResultL = static_cast<int>(lineV0[k]) * _volume;
+    *pResultR = static_cast<int>(lineV1[k]) * _volume;
+  }
+
+  // 最後のサンプルの状態を残す
+  _diff[0] = diffU[num - 1];
+  _diff[1] = diffV[num - 1];
+  _diff[2] = diffW[num - 1];
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    _invPhaseV[i_p] = (_diff[i_p] >= 0.0f);
   }
+  _invLineV[0] = _invPhaseV[0] - _invPhaseV[1];
+  _invLineV[1] = _invPhaseV[1] - _invPhaseV[2];
+}
+
+/// @brief 同期モードまたはスイッチング角を指定するモードの区間を、キャッシュした1周期ぶんの波形テーブルを参照して生成する.
+///        VVVF_ENGINE_BLEP のために、_diff には相電圧出力に応じて±0.5を入れておく(スイッチング時刻はサンプル間の中央とみなされる)
+void VVVFSoundClass::renderSyncCached(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  const SyncPatternClass* pPattern = nullptr;
+  for (size_t i = begin; i < end; i++) {
+    float fs = _control.fs[i];
+    advancePhase(fs);
+    _Vs = _control.vs[i];
+
+    // Vsの量子化段が変わったときだけテーブルを引き直す
+    int vsStep = static_cast<int>(_Vs * SYNC_VS_STEPS + 0.5f);
+    if (pPattern == nullptr || pPattern->vsStep != vsStep) {
+      pPattern = &getSyncPattern(pmIndex, vsStep);
+    }
+
+    uint8_t bits = pPattern->lookup(_phaseSin[0]);
+    _invPhaseV[0] = bits & 0x1;
+    _invPhaseV[1] = (bits >> 1) & 0x1;
+    _invPhaseV[2] = (bits >> 2) & 0x1;
+    _diff[0] = _invPhaseV[0] - 0.5f;
+    _diff[1] = _invPhaseV[1] - 0.5f;
+    _diff[2] = _invPhaseV[2] - 0.5f;
+    writeSample(buf, i);
+  }
+}
+
+/// @brief 指定された (パルスモード, 量子化したVs) に対応する波形テーブルを取得する. キャッシュにない場合は作成する
+/// @param[in] pmIndex パルスモードのインデックス
+/// @param[in] vsStep 量子化したVs
+/// @retval 波形テーブルへの参照
+const SyncPatternClass& VVVFSoundClass::getSyncPattern(const size_t pmIndex, const int vsStep) {
+  return _syncCache.get(_carData, pmIndex, vsStep, _syncCarrier, _sineTable, _sinePrecision);
+}
+
+/// @brief 線間電圧のスペクトルから区間を生成する(VVVF_ENGINE_SPECTRAL).
+///        SPECTRAL_CONTROL_PERIOD サンプルごとに成分の振幅と周波数を計算し直し、各成分の初期値を信号波・キャリアの位相から求める.
+///        その間は回転行列で各成分を1サンプルずつ進め、Vec4f::WIDTH 成分ずつまとめて足し合わせる
+void VVVFSoundClass::renderSpectral(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  const int mode = _carData._listMode[pmIndex];
+  float s[SPECTRAL_PARTIAL_MAX], c[SPECTRAL_PARTIAL_MAX];  // 各成分のsin,cos
+  float sinStep[SPECTRAL_PARTIAL_MAX], cosStep[SPECTRAL_PARTIAL_MAX];  // 各成分の1サンプルあたりの回転
+
+  for (size_t i = begin; i < end; ) {
+    size_t num = end - i;
+    if (num > SPECTRAL_CONTROL_PERIOD) {
+      num = SPECTRAL_CONTROL_PERIOD;
+    }
+
+    // 区間の先頭の周波数で成分の周波数を決める. 非同期キャリア周波数のランダム変調は区間ごとに更新する
+    float fs = _control.fs[i];
+    _Vs = _control.vs[i];
+    float fcCenter = 0.0f;
+    if (mode == ASYNC) {
+      fcCenter = _carData._listFcSlope[pmIndex] * fs + _carData._listFcIntercept[pmIndex];
+      _frand = _carData._listFrandSlope[pmIndex] * fs + _carData._listFrandIntercept[pmIndex];
+      _fc = fcCenter + _frand * _random.next();
+    }
+
+    // 成分の振幅はVsだけで決まるので、Vsか、成分の取捨に影響する周波数が変わったときだけ一覧を作り直す.
+    // 同期モードはVsを波形テーブルと同じ段数で量子化し、周波数は調べる高調波の次数の上限で表す
+    int vsStep, rangeStep;
+    if (mode != ASYNC) {
+      vsStep = static_cast<int>(_Vs * SYNC_VS_STEPS + 0.5f);
+      rangeStep = static_cast<int>(SPECTRAL_FREQ_MAX / fs);
+      if (rangeStep > SPECTRAL_K_MAX) {
+        rangeStep = SPECTRAL_K_MAX;
+      }
+    } else {
+      vsStep = static_cast<int>(_Vs * SPECTRAL_VS_STEPS + 0.5f);
+      rangeStep = static_cast<int>(fs);
+    }
+    if (_specPmIndex != static_cast<int>(pmIndex) || _specVsStep != vsStep || _specRangeStep != rangeStep) {
+      if (mode != ASYNC) {
+        buildSpectralSync(pmIndex, rangeStep, vsStep);
+      } else {
+        buildSpectralAsync(fs, fcCenter);
+      }
+      _specPmIndex = pmIndex;
+      _specVsStep = vsStep;
+      _specRangeStep = rangeStep;
+    }
+
+    // 各成分の初期値と回転を求める. 区間内では周波数一定とみなす.
+    // SINE_PRECISION_LERP では、比較器方式の信号波と同じ多項式のSIMDカーネルで Vec4f::WIDTH 成分ずつ求める
+    const int numVec = (_specNum + Vec4f::WIDTH - 1) / Vec4f::WIDTH * Vec4f::WIDTH;
+    if (_sinePrecision == SINE_PRECISION_LERP) {
+      const Vec4f phaseCarrier = Vec4f::set1(_phaseCarrier);
+      const Vec4f phaseSin = Vec4f::set1(_phaseSin[0]);
+      const Vec4f freqCarrier = Vec4f::set1(_fc * T_SAMPLE_F);
+      const Vec4f freqSin = Vec4f::set1(fs * T_SAMPLE_F);
+      for (int j = 0; j < numVec; j += Vec4f::WIDTH) {
+        Vec4f m = Vec4f::load(&_specM[j]);
+        Vec4f n = Vec4f::load(&_specN[j]);
+        Vec4f phase = m * phaseCarrier + n * phaseSin;
+        Vec4f step = m * freqCarrier + n * freqSin;
+        Vec4f vs, vc, rs, rc;
+        Vec4f::sinCosCycle(phase - phase.floor(), vs, vc);
+        Vec4f::sinCosCycle(step - step.floor(), rs, rc);
+        vs.store(&s[j]);
+        vc.store(&c[j]);
+        rs.store(&sinStep[j]);
+        rc.store(&cosStep[j]);
+      }
+    } else {
+      for (int j = 0; j < _specNum; j++) {
+        float phase = _specM[j] * _phaseCarrier + _specN[j] * _phaseSin[0];
+        float step = (_specM[j] * _fc + _specN[j] * fs) * T_SAMPLE_F;
+        phase -= floorf(phase);
+        step -= floorf(step);
+        s[j] = _sineTable.calc(phase, _sinePrecision);
+        c[j] = _sineTable.calc(phase + 0.25f - (phase >= 0.75f), _sinePrecision);
+        sinStep[j] = _sineTable.calc(step, _sinePrecision);
+        cosStep[j] = _sineTable.calc(step + 0.25f - (step >= 0.75f), _sinePrecision);
+      }
+    }
+    for (int j = _specNum; j < numVec; j++) {
+      s[j] = 0.0f;  c[j] = 0.0f;  sinStep[j] = 0.0f;  cosStep[j] = 1.0f;  // 端数の成分は鳴らさない
+    }
+
+    for (size_t k = 0; k < num; k++) {
+      Vec4f lineUV = Vec4f::set1(0.0f);
+      Vec4f lineVW = Vec4f::set1(0.0f);
+      for (int j = 0; j < numVec; j += Vec4f::WIDTH) {
+        Vec4f vs = Vec4f::load(&s[j]);
+        Vec4f vc = Vec4f::load(&c[j]);
+        Vec4f rs = Vec4f::load(&sinStep[j]);
+        Vec4f rc = Vec4f::load(&cosStep[j]);
+        Vec4f ns = vs * rc + vc * rs;  // 1サンプル進める
+        Vec4f nc = vc * rc - vs * rs;
+        ns.store(&s[j]);
+        nc.store(&c[j]);
+        lineUV = lineUV + ns * Vec4f::load(&_specCoef[0][j]) + nc * Vec4f::load(&_specCoef[1][j]);
+        lineVW = lineVW + ns * Vec4f::load(&_specCoef[2][j]) + nc * Vec4f::load(&_specCoef[3][j]);
+      }
+      int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*(i + k)]);
+      int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*(i + k) + 2]);
+      *pResultL = static_cast<int16_t>(lineUV.sum() * _volume);
+      *pResultR = static_cast<int16_t>(lineVW.sum() * _volume);
+    }
+
+    // 信号波とキャリアの位相を区間の長さだけ進める. 信号波は各サンプルの周波数で積分する
+    float fsSum = 0.0f;
+    for (size_t k = 0; k < num; k++) {
+      fsSum += _control.fs[i + k];
+    }
+    _phaseSin[2] += fsSum * T_SAMPLE_F;
+    _phaseSin[2] -= (int)_phaseSin[2];
+    _phaseSin[1] = _phaseSin[2] + 1.0f/3.0f;
+    _phaseSin[0] = _phaseSin[2] + 2.0f/3.0f;
+    _phaseSin[0] -= (int)_phaseSin[0];
+    _phaseSin[1] -= (int)_phaseSin[1];
+    if (mode == ASYNC) {
+      _phaseCarrier += _fc * T_SAMPLE_F * num;
+      _phaseCarrier -= (int)_phaseCarrier;
+    }
+    i += num;
+  }
+}
+
+/// @brief 非同期モードで、VVVF_ENGINE_SPECTRAL で合成する成分の一覧を現在の信号波電圧から作る.
+///        三角波比較の相電圧(-1 to 1)は、キャリア位相x, 信号波位相yを用いて次のように展開できる
+///          Vs*cos(y) + Σ_m Σ_n 4/(mπ) * J_n(mπVs/2) * sin((m+n)π/2) * cos(mx + ny)
+///        ここでxはキャリアの谷(-1)で0, yはU相の信号波の正のピークで0とする. 線間電圧ではnが3の倍数の成分が打ち消し合う
+/// @param[in] fs 信号波周波数[Hz]
+/// @param[in] fc キャリア周波数[Hz]
+void VVVFSoundClass::buildSpectralAsync(const float fs, const float fc) {
+  const float AMP_MIN = 1.0e-3f;  // これより小さい成分は合成しない(-60dB)
+  const float Vs = (_Vs < 1.0f) ? _Vs : 1.0f;  // 展開式は過変調領域では成り立たないので1で頭打ちにする
+  float J[SPECTRAL_N_MAX + 1];
+
+  _specNum = 0;
+  addSpectralPartial(0, 1, Vs, -3);  // 基本波. y = 2π*(U相の位相) - π/2
+  for (int m = 1; m <= SPECTRAL_M_MAX; m++) {
+    if (m * fc - SPECTRAL_N_MAX * fs >= SPECTRAL_FREQ_MAX) {
+      break;  // これ以上のキャリア高調波群は可聴域に成分を持たない
+    }
+    calcBesselJ(m * PI_F * Vs * 0.5f, SPECTRAL_N_MAX, J);
+    for (int a = 1; a <= SPECTRAL_N_MAX; a++) {
+      if (((m + a) & 1) == 0 || a % 3 == 0) {
+        continue;  // sin((m+n)π/2)=0 の成分, 線間で打ち消し合う成分
+      }
+      for (int n = -a; n <= a; n += 2 * a) {
+        float Jn = ((n < 0) && (a & 1)) ? -J[a] : J[a];  // J_-n = (-1)^n J_n
+        float legAmp = 4.0f / (m * PI_F) * Jn * ((((m + n) % 4 + 4) % 4 == 1) ? 1.0f : -1.0f);
+        float freq = m * fc + n * fs;
+        if (legAmp > -AMP_MIN && legAmp < AMP_MIN) {
+          continue;
+        }
+        if (freq >= SPECTRAL_FREQ_MAX || freq <= -SPECTRAL_FREQ_MAX) {
+          continue;
+        }
+        if (!addSpectralPartial(m, n, legAmp, -3 * n)) {
+          return;  // 成分数が上限に達した
+        }
+      }
+    }
+  }
+}
+
+/// @brief 相電圧の成分 legAmp*cos(2π(m*xc + n*pU + offset/12)) から、線間電圧の成分を追加する.
+///        xcはキャリア位相, pUはU相の信号波位相
+/// @param[in] m キャリアの次数
+/// @param[in] n 信号波の次数
+/// @param[in] legAmp 相電圧での振幅
+/// @param[in] offset 位相のずれ. 位相のずれはすべて1/12周期の整数倍になるので、1/12周期単位で表す
+/// @retval 1:success, 0:成分数が上限に達した
+int VVVFSoundClass::addSpectralPartial(const int m, const int n, const float legAmp, const int offset) {
+  static const float SIN_TWELFTH[12] = {  // sin(2πk/12)
+    0.0f, 0.5f, 0.8660254f, 1.0f, 0.8660254f, 0.5f, 0.0f, -0.5f, -0.8660254f, -1.0f, -0.8660254f, -0.5f
+  };
+  if (_specNum >= _spectralPartialNum) {
+    return 0;
+  }
+  // U-V線間: -legAmp*sin(πn/3) * sin(2π(θ - n/6)), V-W線間: -legAmp*sin(πn/3) * sin(2π(θ - n/2))
+  float amp = -legAmp * SIN_TWELFTH[((2 * n) % 12 + 12) % 12];
+  int offsetUV = ((offset - 2 * n) % 12 + 12) % 12;
+  int offsetVW = ((offset - 6 * n) % 12 + 12) % 12;
+
+  // amp*sin(θ+o) = amp*cos(o)*sin(θ) + amp*sin(o)*cos(θ)
+  const int j = _specNum++;
+  _specM[j] = m;
+  _specN[j] = n;
+  _specCoef[0][j] = amp * SIN_TWELFTH[(offsetUV + 3) % 12];
+  _specCoef[1][j] = amp * SIN_TWELFTH[offsetUV];
+  _specCoef[2][j] = amp * SIN_TWELFTH[(offsetVW + 3) % 12];
+  _specCoef[3][j] = amp * SIN_TWELFTH[offsetVW];
   return 1;
 }
 
-/// @brief 周波数fsに対応するパルスモードを取得する
+/// @brief 同期モードおよびスイッチング角を指定するモードで、VVVF_ENGINE_SPECTRAL で合成する成分の一覧を作る.
+///        同期モードでは各キャリア高調波群の側帯波が信号波の高調波に重なり、上の展開式は収束が遅いので、
+///        1周期ぶんの波形テーブル(getSyncPattern)から線間電圧のエッジを拾い、フーリエ級数を直接求める.
+///        振幅の大きいものから setSpectralPartialNum() 個を選ぶ
+/// @param[in] pmIndex パルスモードのインデックス
+/// @param[in] kMax 調べる高調波の次数の上限
+/// @param[in] vsStep 量子化したVs
+void VVVFSoundClass::buildSpectralSync(const size_t pmIndex, const int kMax, const int vsStep) {
+  const SyncPatternClass& rPattern = getSyncPattern(pmIndex, vsStep);
+
+  // 線間電圧(-1,0,1)の変化点とその変化量を集める. 変化点の位相は edge/SYNC_TABLE_SIZE
+  float edgeSin[2][SPECTRAL_EDGE_MAX], edgeCos[2][SPECTRAL_EDGE_MAX];  // k次での sin,cos(2πk*p_e)
+  float rotSin[2][SPECTRAL_EDGE_MAX], rotCos[2][SPECTRAL_EDGE_MAX];  // sin,cos(2π*p_e)
+  int jump[2][SPECTRAL_EDGE_MAX];
+  int edgeNum[2] = {0, 0};
+  for (int j = 0; j < SYNC_TABLE_SIZE; j++) {
+    uint8_t prev = rPattern.pattern[(j - 1) & (SYNC_TABLE_SIZE - 1)];
+    uint8_t cur = rPattern.pattern[j];
+    for (int l = 0; l < 2; l++) {
+      int d = (((cur >> l) & 1) - ((cur >> (l + 1)) & 1)) - (((prev >> l) & 1) - ((prev >> (l + 1)) & 1));
+      if (d != 0 && edgeNum[l] < SPECTRAL_EDGE_MAX) {
+        float phase = static_cast<float>(j) / SYNC_TABLE_SIZE;
+        rotSin[l][edgeNum[l]] = _sineTable.calc(phase, _sinePrecision);
+        rotCos[l][edgeNum[l]] = _sineTable.calc(phase + 0.25f - (phase >= 0.75f), _sinePrecision);
+        edgeSin[l][edgeNum[l]] = 0.0f;
+        edgeCos[l][edgeNum[l]] = 1.0f;
+        jump[l][edgeNum[l]] = d;
+        edgeNum[l]++;
+      }
+    }
+  }
+
+  // k次高調波: 変化点 p_e, 変化量 d_e に対して
+  //   Σ_e d_e*cos(2πk*p_e)/(πk) * sin(2πk*pU) - Σ_e d_e*sin(2πk*p_e)/(πk) * cos(2πk*pU)
+  _specNum = 0;
+  float powerMin = 0.0f;  // 選ばれている成分のうち最小の振幅の2乗
+  int indexMin = 0;
+  for (int k = 1; k <= kMax; k++) {
+    // 各変化点の sin,cos(2πk*p_e) を1次ぶん回転させる
+    float coef[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int l = 0; l < 2; l++) {
+      for (int e = 0; e < edgeNum[l]; e++) {
+        float es = edgeSin[l][e] * rotCos[l][e] + edgeCos[l][e] * rotSin[l][e];
+        float ec = edgeCos[l][e] * rotCos[l][e] - edgeSin[l][e] * rotSin[l][e];
+        edgeSin[l][e] = es;
+        edgeCos[l][e] = ec;
+        coef[2 * l] += jump[l][e] * ec;
+        coef[2 * l + 1] -= jump[l][e] * es;
+      }
+    }
+    if (k % 3 == 0) {
+      continue;  // 線間で打ち消し合う
+    }
+    for (int c = 0; c < 4; c++) {
+      coef[c] /= PI_F * k;  // _specCoef と同じ単位にそろえてから、選ばれている成分と比べる
+    }
+    float power = coef[0] * coef[0] + coef[1] * coef[1] + coef[2] * coef[2] + coef[3] * coef[3];
+
+    // 上限に達している場合は最小のものと入れ替える
+    int j;
+    if (_specNum < _spectralPartialNum) {
+      j = _specNum++;
+    } else if (power > powerMin) {
+      j = indexMin;
+    } else {
+      continue;
+    }
+    _specM[j] = 0.0f;
+    _specN[j] = k;
+    for (int c = 0; c < 4; c++) {
+      _specCoef[c][j] = coef[c];
+    }
+    if (_specNum == _spectralPartialNum) {
+      powerMin = -1.0f;
+      for (int i = 0; i < _specNum; i++) {
+        float pw = (_specCoef[0][i] * _specCoef[0][i] + _specCoef[1][i] * _specCoef[1][i]
+                  + _specCoef[2][i] * _specCoef[2][i] + _specCoef[3][i] * _specCoef[3][i]);
+        if (powerMin < 0.0f || pw < powerMin) {
+          powerMin = pw;
+          indexMin = i;
+        }
+      }
+    }
+  }
+}
+
+/// @brief 第1種ベッセル関数 J_0(x) ～ J_nMax(x) をMillerの後退漸化式で求める
+/// @param[in] x 引数(0以上)
+/// @param[in] nMax 求める最大の次数
+/// @param[out] J 結果(nMax+1個)
+void VVVFSoundClass::calcBesselJ(const float x, const int nMax, float* J) {
+  if (x < 1.0e-6f) {
+    J[0] = 1.0f;
+    for (int n = 1; n <= nMax; n++) J[n] = 0.0f;
+    return;
+  }
+  // x+BESSEL_MARGIN 次を超える J_n(x) は無視できるほど小さい(AMP_MIN未満)ので0とし、残りを求める
+  const int BESSEL_MARGIN = 12;
+  int nNeed = (int)x + BESSEL_MARGIN;
+  if (nNeed < nMax) {
+    for (int n = nNeed + 1; n <= nMax; n++) J[n] = 0.0f;
+  } else {
+    nNeed = nMax;
+  }
+  // 十分大きな次数から漸化式 J_{n-1} = 2n/x*J_n - J_{n+1} で下っていき、J_0 + 2ΣJ_2k = 1 で正規化する
+  int start = nNeed + BESSEL_MARGIN;
+  start += start & 1;  // 偶数から始める
+  float jp = 0.0f;   // J_{n+1}
+  float jn = 1.0e-20f;  // J_n
+  float sum = 0.0f;
+  for (int n = start; n > 0; n--) {
+    float jm = 2.0f * n / x * jn - jp;  // J_{n-1}
+    jp = jn;
+    jn = jm;
+    if (n - 1 <= nNeed) {
+      J[n - 1] = jm;
+    }
+    if (((n - 1) & 1) == 0 && n - 1 > 0) {
+      sum += 2.0f * jm;
+    }
+    if (jm > 1.0e15f || jm < -1.0e15f) {
+      // オーバーフローしないように、それまでの値ごと縮める
+      jp *= 1.0e-15f;
+      jn *= 1.0e-15f;
+      sum *= 1.0e-15f;
+      for (int k = n - 1; k <= nNeed; k++) J[k] *= 1.0e-15f;
+    }
+  }
+  sum += jn;  // J_0
+  for (int n = 0; n <= nNeed; n++) J[n] /= sum;
+}
+
+/// @brief 未対応モードの区間を生成する. 相電圧出力は直前の値を保持する
+void VVVFSoundClass::renderHold(uint8_t* buf, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    float fs = _control.fs[i];
+    advancePhase(fs);
+    _Vs = _control.vs[i];
+    writeSample(buf, i);
+  }
+}
+
+/// @brief 1ブロックぶんの線間電圧を主電動機のRL回路に通し、電流に置き換える.
+///        各相の巻線は L*di/dt + R*i = v - e (eは誘起電圧)に従う. L,Rは3相で等しいので、線間電圧を入力とすると
+///        出力は2相の電流の差になり、中性点の電位は打ち消し合う. 誘起電圧は相電圧出力の基本波(calcFundamental)とし、
+///        信号波位相はブロック先頭の位相から各サンプルの信号波周波数で積分し直す. 出力は1/_volumeした値で計算する
+/// @param[in,out] buf このブロックの先頭サンプルを指す出力バッファ. 線間電圧が書かれており、電流で上書きされる
+/// @param[in] num ブロックのサンプル数
+/// @param[in] phaseStart ブロックの直前のサンプルにおけるW相の信号波位相
+void VVVFSoundClass::applyMotorCurrent(uint8_t* buf, size_t num, float phaseStart) {
+  if (_volume == 0) {
+    return;
+  }
+  const float invVolume = 1.0f / _volume;
+  const size_t period = _controlPeriod;
+  const Vec4f oneThird = Vec4f::set1(1.0f/3.0f);
+  const Vec4f twoThirds = Vec4f::set1(2.0f/3.0f);
+  float phase[SIMD_BLOCK], emf[SIMD_BLOCK], lineV[2][SIMD_BLOCK];
+  float p = phaseStart;
+  for (size_t b = 0; b < num; b += SIMD_BLOCK) {
+    size_t n = (num - b < SIMD_BLOCK) ? num - b : SIMD_BLOCK;
+    for (size_t k = 0; k < n; k++) {
+      p += _control.fs[b + k] * T_SAMPLE_F;
+      p -= (int)p;
+      phase[k] = p;
+      emf[k] = _ctrlEmf[(b + k) / period];
+      lineV[0][k] = *reinterpret_cast<int16_t*>(&buf[4*(b + k)]) * invVolume;
+      lineV[1][k] = *reinterpret_cast<int16_t*>(&buf[4*(b + k) + 2]) * invVolume;
+    }
+    size_t numVec = (n + Vec4f::WIDTH - 1) / Vec4f::WIDTH * Vec4f::WIDTH;
+    for (size_t k = n; k < numVec; k++) {
+      phase[k] = phase[n - 1];
+      emf[k] = emf[n - 1];
+      lineV[0][k] = lineV[0][n - 1];
+      lineV[1][k] = lineV[1][n - 1];
+    }
+
+    // 線間の誘起電圧を差し引く
+    for (size_t k = 0; k < numVec; k += Vec4f::WIDTH) {
+      Vec4f pW = Vec4f::load(&phase[k]);
+      Vec4f amp = Vec4f::load(&emf[k]);
+      Vec4f sU = Vec4f::sinCycle(pW + twoThirds);
+      Vec4f sV = Vec4f::sinCycle(pW + oneThird);
+      Vec4f sW = Vec4f::sinCycle(pW);
+      (Vec4f::load(&lineV[0][k]) - amp * (sU - sV)).store(&lineV[0][k]);
+      (Vec4f::load(&lineV[1][k]) - amp * (sV - sW)).store(&lineV[1][k]);
+    }
+
+    for (int i_line = 0; i_line < 2; i_line++) {
+      _motorCurrent[i_line].process(lineV[i_line], lineV[i_line], n);
+      for (size_t k = 0; k < n; k++) {
+        int v = static_cast<int>(_motorCurrentHPF[i_line].update(lineV[i_line][k], T_SAMPLE_F) * _volume);
+        if (v > 32767) v = 32767;
+        if (v < -32767) v = -32767;
+        *reinterpret_cast<int16_t*>(&buf[4*(b + k) + 2*i_line]) = static_cast<int16_t>(v);
+      }
+    }
+  }
+}
+
+/// @brief 相電圧出力(0または1)の基本波の振幅を求める. 非同期モードでは過変調でない限り Vs/2 で、過変調では1パルスの値 2/π で頭打ちとする.
+///        同期モードとスイッチング角を指定するモードでは、パルス数が少ないとVs/2から大きくずれるので波形テーブルから求める
+/// @param[in] pmIndex パルスモードのインデックス
+/// @param[in] Vs 信号波電圧
+/// @retval 基本波の振幅
+float VVVFSoundClass::calcFundamental(const int pmIndex, const float Vs) {
+  if (pmIndex < 0 || pmIndex >= static_cast<int>(_carData._pmNum)) {
+    return 0.0f;
+  }
+  const int mode = _carData._listMode[pmIndex];
+  if (mode == ASYNC) {
+    float amp = 0.5f * Vs;
+    return (amp < 2.0f / PI_F) ? amp : 2.0f / PI_F;
+  }
+  if (mode == SYNC || SwitchingAngleClass::isAngleMode(mode)) {
+    return getSyncPattern(pmIndex, static_cast<int>(Vs * SYNC_VS_STEPS + 0.5f)).fundamental;
+  }
+  return 0.0f;
+}
+
+#ifdef USE_FIXED_POINT
+/// @brief 非同期モードの区間を固定小数点演算で生成する
+void VVVFSoundClass::renderAsyncFixed(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  for (size_t i = begin; i < end; i++) {
+    float fs = _control.fs[i];
+    advancePhaseFixed(fs, _control.vs[i]);
+
+    // 搬送波の位相を進め、1周を超えたとき(または未計算のとき)キャリア周波数を再計算
+    uint32_t prevPhaseCarrierQ = _phaseCarrierQ;
+    _phaseCarrierQ += _incCarrierQ;
+    if (_phaseCarrierQ < prevPhaseCarrierQ || _incCarrierQ == 0) {
+      _fc = _carData._listFcSlope[pmIndex] * fs + _carData._listFcIntercept[pmIndex];
+      _frand = _carData._listFrandSlope[pmIndex] * fs + _carData._listFrandIntercept[pmIndex];
+      _fc += _frand * _random.next();  // ずれ幅をランダムに更新
+      _incCarrierQ = static_cast<uint32_t>(_fc * PHASE_PER_HZ);
+    }
+
+    // 瞬時値を計算(Q15). 位相の上位16bitを0-1のQ16とみなす
+    int32_t x = _phaseCarrierQ >> 16;
+    _ampCarrierQ = (x < 32768) ? 2*x - 32768 : 98304 - 2*x;
+
+    comparePhasesFixed();
+    writeSample(buf, i);
+  }
+}
+
+/// @brief 同期モードの区間を固定小数点演算で生成する. キャリアはU相の信号波位相から SyncCarrierClass::calcQ15() で求める
+void VVVFSoundClass::renderSyncFixed(uint8_t* buf, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    advancePhaseFixed(_control.fs[i], _control.vs[i]);
+
+    uint32_t phaseU = _phaseSinQ + 0xAAAAAAABu;
+    _ampCarrierQ = _syncCarrier.calcQ15(phaseU);
+
+    comparePhasesFixed();
+    writeSample(buf, i);
+  }
+}
+
+/// @brief スイッチング角を指定するモードの区間を、波形テーブルを参照して固定小数点演算で生成する
+void VVVFSoundClass::renderSyncCachedFixed(uint8_t* buf, size_t begin, size_t end) {
+  const size_t pmIndex = _pmIndex;
+  const SyncPatternClass* pPattern = nullptr;
+  for (size_t i = begin; i < end; i++) {
+    advancePhaseFixed(_control.fs[i], _control.vs[i]);
+
+    int vsStep = (_VsQ * SYNC_VS_STEPS + 16384) >> 15;
+    if (pPattern == nullptr || pPattern->vsStep != vsStep) {
+      pPattern = &getSyncPattern(pmIndex, vsStep);
+    }
+
+    uint8_t bits = pPattern->pattern[(_phaseSinQ + 0xAAAAAAABu) >> (32 - SYNC_TABLE_BITS)];  // U相の位相で引く
+    _invPhaseV[0] = bits & 0x1;
+    _invPhaseV[1] = (bits >> 1) & 0x1;
+    _invPhaseV[2] = (bits >> 2) & 0x1;
+    writeSample(buf, i);
+  }
+}
+
+/// @brief 未対応モードの区間を固定小数点演算で生成する. 相電圧出力は直前の値を保持する
+void VVVFSoundClass::renderHoldFixed(uint8_t* buf, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    advancePhaseFixed(_control.fs[i], _control.vs[i]);
+    writeSample(buf, i);
+  }
+}
+
+/// @brief 固定小数点の信号波位相をサンプリング時間分進め、信号波電圧をQ15に変換する
 /// @param[in] fs 信号波周波数[Hz]
-/// @retval パルスモードのインデックス(0,1,...,_pmNum-1)
-size_t VVVFSoundClass::getPulsemodeIndex(const float fs) {
-  int i = 0;
-  for (i = _carData._pmNum-1; i>=0; i--) {  // search _carData._listMode[_pmIndex[i_p]] index
-    if (fs >= _carData._listFs[i]) break;
+/// @param[in] vs 信号波電圧
+inline void VVVFSoundClass::advancePhaseFixed(const float fs, const float vs) {
+  _phaseSinQ += static_cast<uint32_t>(fs * PHASE_PER_HZ);  // 2^32を超えた分は自然に切り捨てられる
+  _VsQ = static_cast<int32_t>(vs * 32768.0f);
+}
+
+/// @brief 固定小数点の信号波と搬送波を3相ぶん比較し、相電圧出力を計算する
+inline void VVVFSoundClass::comparePhasesFixed() {
+  _invPhaseV[0] = ((_VsQ * _sineTable.lerpQ15(_phaseSinQ + 0xAAAAAAABu)) >> 15) >= _ampCarrierQ;  // +2/3周期
+  _invPhaseV[1] = ((_VsQ * _sineTable.lerpQ15(_phaseSinQ + 0x55555555u)) >> 15) >= _ampCarrierQ;  // +1/3周期
+  _invPhaseV[2] = ((_VsQ * _sineTable.lerpQ15(_phaseSinQ)) >> 15) >= _ampCarrierQ;
+}
+#endif
+
+/// @brief 信号波位相をサンプリング時間分進める
+/// @param[in] fs 信号波周波数[Hz]
+inline void VVVFSoundClass::advancePhase(const float fs) {
+  _phaseSin[2] += fs * (float)_dt;  // 位相をPWMの時間刻み分進める(倍精度への昇格を避ける)
+  _phaseSin[1] = _phaseSin[2] + 1.0f/3.0f;
+  _phaseSin[0] = _phaseSin[2] + 2.0f/3.0f;
+  _phaseSin[0] -= (int)_phaseSin[0];  // 整数部を引いて0から1に収める
+  _phaseSin[1] -= (int)_phaseSin[1];
+  _phaseSin[2] -= (int)_phaseSin[2];
+}
+
+/// @brief 相電圧出力から線間電圧を計算し、出力バッファのi番目のサンプルに書き込む
+/// @param[out] buf 出力バッファ
+/// @param[in] i サンプル番号
+inline void VVVFSoundClass::writeSample(uint8_t* buf, const size_t i) {
+  if (_engine == VVVF_ENGINE_BLEP) {
+    writeSampleBlep(buf, i);
+    return;
+  }
+
+  // 出力先アドレスを出力バッファの適切な位置に指定
+  int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*i]);
+  int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*i+2]);
+  // 線間電圧を計算
+  _invLineV[0] = _invPhaseV[0] - _invPhaseV[1];
+  _invLineV[1] = _invPhaseV[1] - _invPhaseV[2];
+  // _invLineV[2] = _invPhaseV[2] - _invPhaseV[0];
+  // 出力(LPFを通さない方が、ジョイント音と合わせた際に綺麗)
+  *pResultL = _invLineV[0] * _volume;  //_firstLPF0.update(_invLineV[0] * _volume, T_SAMPLE);
+  *pResultR = _invLineV[1] * _volume;  // _firstLPF1.update(_invLineV[1] * _volume, T_SAMPLE);
+}
+
+/// @brief 相電圧出力の切り替わりをPolyBLEPで帯域制限し、線間電圧を出力バッファのi番目のサンプルに書き込む.
+///        スイッチング時刻は、1サンプル前と現在の _diff を直線で結んで0を横切る時刻として求める.
+///        サンプルごとに比較器で相電圧出力を求める区間(スイッチング角を指定するモードなど)で用いる
+/// @param[out] buf 出力バッファ
+/// @param[in] i サンプル番号
+inline void VVVFSoundClass::writeSampleBlep(uint8_t* buf, const size_t i) {
+  float lineV[2] = {0.0f, 0.0f};  // 現在のサンプルの線間電圧の補正
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    if (_invPhaseV[i_p] != _blepPhaseV[i_p]) {
+      // スイッチング時刻(1サンプル前からの経過割合)を求める
+      float denom = _blepDiff[i_p] - _diff[i_p];
+      float a = (denom != 0.0f) ? _blepDiff[i_p] / denom : 1.0f;
+      addBlepResidual(i_p, a, lineV);
+      _blepPhaseV[i_p] = _invPhaseV[i_p];
+    }
+    _blepDiff[i_p] = _diff[i_p];
+  }
+  outputBlep(buf, i, lineV);
+}
+
+/// @brief 時刻 n-1+a (nは現在のサンプル) の相電圧出力の切り替わりについて、PolyBLEPの補正を加える.
+///        高さhのステップに対し、サンプル n-1 に h(1-a)^2/2、サンプル n に -h*a^2/2 を加える. 相電圧出力は切り替わり後の値にしておくこと
+/// @param[in] i_phase 相番号. 0,1,2のどれか
+/// @param[in] a 切り替わりの時刻(1サンプル前からの経過割合). 0から1の範囲に丸める
+/// @param[in,out] lineV 現在のサンプルの線間電圧の補正
+inline void VVVFSoundClass::addBlepResidual(const size_t i_phase, const float a, float* lineV) {
+  static const float LINE_SIGN[2][3] = {{1.0f, -1.0f, 0.0f}, {0.0f, 1.0f, -1.0f}};  // 各相の相電圧が各線間電圧に寄与する符号
+  float x = (a < 0.0f) ? 0.0f : ((a > 1.0f) ? 1.0f : a);
+  float h = _invPhaseV[i_phase] ? 1.0f : -1.0f;
+  float residualBefore = 0.5f * h * (1.0f - x) * (1.0f - x);
+  float residualAfter = -0.5f * h * x * x;
+  _blepLineV[0] += LINE_SIGN[0][i_phase] * residualBefore;
+  _blepLineV[1] += LINE_SIGN[1][i_phase] * residualBefore;
+  lineV[0] += LINE_SIGN[0][i_phase] * residualAfter;
+  lineV[1] += LINE_SIGN[1][i_phase] * residualAfter;
+}
+
+/// @brief 現在のサンプルとの相対時刻 t (-1<t<=0) に相電圧出力を反転させ、PolyBLEPの補正を加える
+/// @param[in] i_phase 相番号. 0,1,2のどれか
+/// @param[in] t スイッチング時刻. 現在のサンプルからの相対時刻[サンプル]
+/// @param[in,out] lineV 現在のサンプルの線間電圧の補正
+inline void VVVFSoundClass::applyBlepEdge(const size_t i_phase, const float t, float* lineV) {
+  _invPhaseV[i_phase] = !_invPhaseV[i_phase];
+  _blepPhaseV[i_phase] = _invPhaseV[i_phase];
+  _blepEdgePending[i_phase] = false;
+  addBlepResidual(i_phase, 1.0f + t, lineV);
+}
+
+/// @brief 予定しているスイッチングの時刻を1サンプル進め、現在のサンプルまでに来たものを出力する
+/// @param[in,out] lineV 現在のサンプルの線間電圧の補正
+inline void VVVFSoundClass::applyDueBlepEdges(float* lineV) {
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    if (_blepEdgePending[i_p]) {
+      _blepEdgeTime[i_p] -= 1.0f;
+      if (_blepEdgeTime[i_p] <= 0.0f) {
+        applyBlepEdge(i_p, _blepEdgeTime[i_p], lineV);
+      }
+    }
+  }
+}
+
+/// @brief キャリアが直線である区間に入ったとき、区間内の各相のスイッチング時刻を求める.
+///        区間の両端で信号波とキャリアの差を求め、符号が変わる相についてはさみうち法を2回行って交点を求める.
+///        信号波の周波数・電圧は区間内で一定とみなす. 区間内でのスイッチングは1相につき1回までとする
+/// @param[in] cStart 区間の始点でのキャリアの値
+/// @param[in] slope キャリアの傾き[1/サンプル]
+/// @param[in] tStart 区間の始点. 現在のサンプルからの相対時刻[サンプル](-1<tStart<=0)
+/// @param[in] tEnd 区間の終点. 現在のサンプルからの相対時刻[サンプル]
+/// @param[in] dPhase 信号波の1サンプルあたりの位相の増分
+/// @param[in,out] lineV 現在のサンプルの線間電圧の補正
+inline void VVVFSoundClass::startBlepPiece(const float cStart, const float slope, const float tStart, const float tEnd, const float dPhase, float* lineV) {
+  const float cEnd = cStart + slope * (tEnd - tStart);
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    if (_blepEdgePending[i_p]) {
+      applyBlepEdge(i_p, tStart, lineV);  // 前の区間のスイッチングが丸め誤差で残っている場合
+    }
+    float p = _phaseSin[i_p] + dPhase * tStart;
+    float gStart = _Vs * _sineTable.calc(p - floorf(p), _sinePrecision) - cStart;
+    if ((gStart >= 0.0f) != _invPhaseV[i_p]) {
+      applyBlepEdge(i_p, tStart, lineV);  // 区間の始点で既に切り替わっている
+    }
+    p = _phaseSin[i_p] + dPhase * tEnd;
+    float gEnd = _Vs * _sineTable.calc(p - floorf(p), _sinePrecision) - cEnd;
+    if ((gEnd >= 0.0f) == _invPhaseV[i_p]) {
+      continue;  // 区間内では切り替わらない
+    }
+
+    // はさみうち法で交点を求め、交点と符号の異なる側の端との間でもう1回はさみうちする
+    float t1 = tStart + gStart * (tEnd - tStart) / (gStart - gEnd);
+    p = _phaseSin[i_p] + dPhase * t1;
+    float g1 = _Vs * _sineTable.calc(p - floorf(p), _sinePrecision) - (cStart + slope * (t1 - tStart));
+    float t;
+    if ((g1 >= 0.0f) == (gStart >= 0.0f)) {
+      t = t1 + g1 * (tEnd - t1) / (g1 - gEnd);
+    } else {
+      t = tStart + gStart * (t1 - tStart) / (gStart - g1);
+    }
+    if (t <= 0.0f) {
+      applyBlepEdge(i_p, t, lineV);
+    } else {
+      _blepEdgePending[i_p] = true;
+      _blepEdgeTime[i_p] = t;
+    }
+  }
+}
+
+/// @brief 1サンプル前の線間電圧(補正込み)を出力バッファの i-1 番目のサンプルとして書き込み、現在のサンプルを出力待ちにする.
+///        書き込み先は i 番目なので、出力は1サンプル遅れる
+/// @param[out] buf 出力バッファ
+/// @param[in] i サンプル番号
+/// @param[in] lineV 現在のサンプルの線間電圧の補正
+inline void VVVFSoundClass::outputBlep(uint8_t* buf, const size_t i, const float* lineV) {
+  int16_t* pResultL = reinterpret_cast<int16_t*>(&buf[4*i]);
+  int16_t* pResultR = reinterpret_cast<int16_t*>(&buf[4*i+2]);
+  *pResultL = static_cast<int16_t>(_blepLineV[0] * _volume);
+  *pResultR = static_cast<int16_t>(_blepLineV[1] * _volume);
+  _blepLineV[0] = static_cast<float>(_invPhaseV[0] - _invPhaseV[1]) + lineV[0];
+  _blepLineV[1] = static_cast<float>(_invPhaseV[1] - _invPhaseV[2]) + lineV[1];
+}
+
+/// @brief キャリアの区間の途中のサンプルを、区間の終わりの手前までまとめて生成する. スイッチング時刻は区間に入ったときに
+///        求めてあるので、比較は行わない. スイッチングのないサンプルは出力が変わらないので、続くものをまとめて書き込む
+/// @param[out] buf 出力バッファ
+/// @param[in] i 最初のサンプル番号
+/// @param[in] end 区間(renderBlock の区間)の終わりのサンプル番号
+/// @param[in] tEnd キャリアの区間の終点. i-1 番目のサンプルからの相対時刻[サンプル]
+/// @param[in] advanceCarrier 非同期キャリアの位相も進める場合 true
+/// @retval 次に生成するサンプル番号
+inline size_t VVVFSoundClass::renderBlepInside(uint8_t* buf, size_t i, const size_t end, float tEnd, const bool advanceCarrier) {
+  const size_t begin = i;
+  for (;;) {
+    size_t steady = countBlepSteady(end - i, tEnd);
+    if (steady > 0) {
+      outputBlepSteady(buf, i, steady, advanceCarrier);
+      i += steady;
+      tEnd -= static_cast<float>(steady);
+    }
+    if (i >= end || tEnd < 2.0f) {
+      break;  // 区間の終わりの近くは、区間の切り替わりを調べながら1サンプルずつ生成する
+    }
+    advanceBlepPhase(i, 1, advanceCarrier);
+    float lineV[2] = {0.0f, 0.0f};
+    applyDueBlepEdges(lineV);
+    outputBlep(buf, i, lineV);
+    i++;
+    tEnd -= 1.0f;
+  }
+
+  // W相の位相だけを進めてきたので、U,V相の位相と信号波電圧をそろえる
+  if (i > begin) {
+    _phaseSin[1] = _phaseSin[2] + 1.0f/3.0f;
+    _phaseSin[0] = _phaseSin[2] + 2.0f/3.0f;
+    _phaseSin[0] -= (int)_phaseSin[0];
+    _phaseSin[1] -= (int)_phaseSin[1];
+    _Vs = _control.vs[i - 1];
   }
   return i;
 }
 
+/// @brief スイッチングもキャリアの区間の終わりも来ない、出力が変わらないサンプルの数を求める.
+///        丸め誤差で区間の終わりを越えないよう、1サンプルの余裕をとる
+/// @param[in] remain 生成する残りのサンプル数
+/// @param[in] tEnd キャリアの区間の終点. 直前に出力したサンプルからの相対時刻[サンプル]
+/// @retval サンプル数. remain を超えない
+inline size_t VVVFSoundClass::countBlepSteady(const size_t remain, const float tEnd) const {
+  float t = tEnd - 1.0f;
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    if (_blepEdgePending[i_p] && _blepEdgeTime[i_p] - 1.0f < t) {
+      t = _blepEdgeTime[i_p] - 1.0f;
+    }
+  }
+  if (t < 1.0f) {
+    return 0;
+  }
+  return (t < static_cast<float>(remain)) ? static_cast<size_t>(t) : remain;
+}
+
+/// @brief 出力が変わらない count サンプルを i 番目から書き込む
+/// @param[out] buf 出力バッファ
+/// @param[in] i 最初のサンプル番号
+/// @param[in] count サンプル数. 1以上
+/// @param[in] advanceCarrier 非同期キャリアの位相も進める場合 true
+inline void VVVFSoundClass::outputBlepSteady(uint8_t* buf, const size_t i, const size_t count, const bool advanceCarrier) {
+  int16_t* pResult = reinterpret_cast<int16_t*>(&buf[4*i]);
+  pResult[0] = static_cast<int16_t>(_blepLineV[0] * _volume);  // 出力待ちのサンプル(補正込み)
+  pResult[1] = static_cast<int16_t>(_blepLineV[1] * _volume);
+  _blepLineV[0] = static_cast<float>(_invPhaseV[0] - _invPhaseV[1]);
+  _blepLineV[1] = static_cast<float>(_invPhaseV[1] - _invPhaseV[2]);
+  const int16_t outL = static_cast<int16_t>(_blepLineV[0] * _volume);
+  const int16_t outR = static_cast<int16_t>(_blepLineV[1] * _volume);
+  for (size_t k = 1; k < count; k++) {
+    pResult[2*k] = outL;
+    pResult[2*k+1] = outR;
+  }
+  advanceBlepPhase(i, count, advanceCarrier);
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    _blepEdgeTime[i_p] -= static_cast<float>(count);
+  }
+}
+
+/// @brief 比較を行わずに、W相の信号波(と非同期キャリア)の位相を count サンプルぶん進める.
+///        U,V相の位相と信号波電圧は renderBlepInside() の終わりでそろえる
+/// @param[in] i 最初のサンプル番号
+/// @param[in] count サンプル数. 1以上
+/// @param[in] advanceCarrier 非同期キャリアの位相も進める場合 true
+inline void VVVFSoundClass::advanceBlepPhase(const size_t i, const size_t count, const bool advanceCarrier) {
+  for (size_t k = 0; k < count; k++) {
+    _phaseSin[2] += _control.fs[i + k] * (float)_dt;  // advancePhase() と同じ順で丸める
+    _phaseSin[2] -= (int)_phaseSin[2];
+  }
+  if (advanceCarrier) {
+    for (size_t k = 0; k < count; k++) {
+      _phaseCarrier += _fc * _dt;
+    }
+  }
+}
+
+/// @brief VVVF_ENGINE_BLEP でスイッチング時刻から生成した区間の終わりに、比較器の状態を相電圧出力に合わせる.
+///        次の区間で writeSampleBlep() を用いる場合、切り替わりはサンプル間の中央とみなされる
+void VVVFSoundClass::finishBlep() {
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    _diff[i_p] = _invPhaseV[i_p] - 0.5f;
+    _blepDiff[i_p] = _diff[i_p];
+  }
+  _invLineV[0] = _invPhaseV[0] - _invPhaseV[1];
+  _invLineV[1] = _invPhaseV[1] - _invPhaseV[2];
+}
+
+/// @brief VVVF_ENGINE_BLEP の内部状態をクリアする. 相電圧出力は現在の値から継続する
+void VVVFSoundClass::clearBlep() {
+  for (size_t i_p = 0; i_p < 3; i_p++) {
+    _blepDiff[i_p] = _diff[i_p];
+    _blepPhaseV[i_p] = _invPhaseV[i_p];
+    _blepEdgePending[i_p] = false;
+    _blepEdgeTime[i_p] = 0.0f;
+  }
+  _blepLineV[0] = static_cast<float>(_invPhaseV[0] - _invPhaseV[1]);
+  _blepLineV[1] = static_cast<float>(_invPhaseV[1] - _invPhaseV[2]);
+  _blepPiece = -1;
+}
+
 /// @brief 非同期キャリア波形を計算する
 /// @param[in] fs 信号波周波数[Hz]
 /// @retval None (VVVFSoundClass の _fc, _frand, _phaseCarrier, _ampCarrier が更新される)
 inline void VVVFSoundClass::calcAsyncTriangle(const float fs, const size_t pmIndex) {
 
-  // サンプリング時刻分位相を進める
-  _phaseCarrier += _fc * T_SAMPLE;
+  // PWMの時間刻み分位相を進める
+  _phaseCarrier += _fc * _dt;
 
   // 1周を超えたとき
   if (_phaseCarrier > 1.0) {
     _phaseCarrier -= 1.0;  // 位相は0-1のあいだなので戻す
 
     // キャリア周波数を再計算
-    float fs1 = _carData._listFs[pmIndex];  // 一次関数の左端と右端
-    float fs2 = (pmIndex==_carData._pmNum-1)? fs1 + 1.0 : _carData._listFs[pmIndex+1];
-    _fc = _carData._listFc1[pmIndex] + (_carData._listFc2[pmIndex] - _carData._listFc1[pmIndex]) * (fs - fs1) / (fs2 - fs1);
-    _frand = _carData._listFrand1[pmIndex] + (_carData._listFrand2[pmIndex] - _carData._listFrand1[pmIndex]) * (fs - fs1) / (fs2 - fs1);
-    _fc += _frand * ((float)rand()/RAND_MAX * 2.0 - 1.0);  // ずれ幅をランダムに更新
+    _fc = _carData._listFcSlope[pmIndex] * fs + _carData._listFcIntercept[pmIndex];  // パルスモード内で一次関数的に変化
+    _frand = _carData._listFrandSlope[pmIndex] * fs + _carData._listFrandIntercept[pmIndex];
+    _fc += _frand * _random.next();  // ずれ幅をランダムに更新
   }
 
   // 瞬時値を計算
@@ -170,61 +1470,23 @@ inline void VVVFSoundClass::calcAsyncTriangle(const float fs, const size_t pmInd
 /// @param[in] i_phase 相番号. 0,1,2のどれか
 /// @retval None (VVVFSoundClass の_invPhaseV に出力される)
 inline void VVVFSoundClass::asyncPWM(const size_t i_phase) {
-  _invPhaseV[i_phase] = (_Vs * sin(2 * PI * _phaseSin[i_phase]) >= _ampCarrier);
+  _diff[i_phase] = _Vs * _sineTable.calc(_phaseSin[i_phase], _sinePrecision) - _ampCarrier;
+  _invPhaseV[i_phase] = (_diff[i_phase] >= 0.0f);
 }
 
-/// @brief 同期PWMに用いるキャリア波形を計算する
-/// @param[in] phaseSin 信号波の位相
-/// @param[in] Npulse パルス数
-/// @retval ampSyncCarrier キャリア波形の瞬時値
-inline void VVVFSoundClass::calcSyncTriangle(const float phaseSin, const int Npulse) {
-  _phaseCarrier = phaseSin * Npulse;
+/// @brief 同期PWMに用いるキャリア波形を計算する. あらかじめ _syncCarrier.setup() で波形を作成しておくこと
+/// @param[in] phaseSin U相の信号波の位相
+/// @retval None (VVVFSoundClass の _phaseCarrier, _ampCarrier が更新される)
+inline void VVVFSoundClass::calcSyncCarrier(const float phaseSin) {
+  _phaseCarrier = phaseSin * _syncCarrier.repeat;
   _phaseCarrier -= (int)_phaseCarrier;
-  if (_phaseCarrier < 0.25) {
-    _ampCarrier = -4.0 * _phaseCarrier;
-  } else if (_phaseCarrier < 0.75) {
-    _ampCarrier = -2.0 + 4.0 * _phaseCarrier;
-  } else {
-    _ampCarrier = 4.0 - 4.0 * _phaseCarrier;
-  }
-}
-
-inline void VVVFSoundClass::calcSyncNot3xPTriangle(const float phaseSin, const int Npulse) {
-  switch (Npulse) {
-  case 5:
-    _phaseCarrier = 3.0*phaseSin;
-    _phaseCarrier -= (int)_phaseCarrier;
-    if (_phaseCarrier < 1.0/8.0) {
-      _ampCarrier = -8.0 * _phaseCarrier;
-    } else if (_phaseCarrier < 2.0/8.0) {
-      _ampCarrier = 8.0 * _phaseCarrier - 2.0;
-    } else if (_phaseCarrier < 3.0/8.0) {
-      _ampCarrier = -8.0 * _phaseCarrier + 2.0;
-    } else if (_phaseCarrier < 5.0/8.0) {
-      _ampCarrier = 8.0 * _phaseCarrier - 4.0;
-    } else if (_phaseCarrier < 6.0/8.0) {
-      _ampCarrier = -8.0 * _phaseCarrier + 6.0;
-    } else if (_phaseCarrier < 7.0/8.0) {
-      _ampCarrier = 8.0 * _phaseCarrier - 6.0;
-    } else {
-      _ampCarrier = -8.0 * _phaseCarrier + 8.0;
-    }
-    break;
-  default:
-    break;
-  }
+  _ampCarrier = _syncCarrier.calc(phaseSin);
 }
 
-/// @brief 1相ぶんの正弦波同期PWMを行う
+/// @brief 1相ぶんの正弦波同期PWMを行う. キャリアはあらかじめ calcSyncCarrier() で計算しておくこと
 /// @param[in] i_phase 相番号. 0,1,2のどれか
 /// @retval None (VVVFSoundClass の_invPhaseV に出力される)
 inline void VVVFSoundClass::syncPWM(const size_t i_phase) {
-  int Npulse = _carData._listNpulse[_pmIndex[i_phase]];
-  if ((Npulse / 3) * 3 != Npulse) {
-    calcSyncNot3xPTriangle(_phaseSin[0], Npulse);
-  } else {
-    calcSyncTriangle(_phaseSin[0], Npulse);
-  }
-  _invPhaseV[i_phase] = (_Vs * sin(2 * PI * _phaseSin[i_phase]) >= _ampCarrier);
-
+  _diff[i_phase] = _Vs * _sineTable.calc(_phaseSin[i_phase], _sinePrecision) - _ampCarrier;
+  _invPhaseV[i_phase] = (_diff[i_phase] >= 0.0f);
 }
@@ -10,12 +10,55 @@
 #include "constant.h"
 #include "CarDataClass.h"
 #include "Filter.h"
+#include "PulsePattern.h"
+#include "PwmControl.h"
+#include "SineTable.h"
+#include "Simd.h"
+
+/// @brief VVVF音の波形生成方式
+typedef enum VVVFEngine {
+  VVVF_ENGINE_COMPARATOR,  // サンプルごとに信号波とキャリアを比較する. 出力は-1,0,1の3値
+  VVVF_ENGINE_BLEP,        // キャリアの区間ごとにスイッチング時刻を求め、PolyBLEPで帯域制限したエッジを出力する. 出力は1サンプル遅れる
+  VVVF_ENGINE_SPECTRAL,    // 線間電圧のスペクトル(基本波とキャリア側帯波)から、可聴域の成分だけを正弦波の和で合成する
+  VVVF_ENGINE_NUM
+} VVVFEngine;
 
 class VVVFSoundClass {
  private:
+  static const int SYNC_TABLE_BITS = SyncPatternClass::TABLE_BITS;  // 同期モードの波形テーブルの1周期あたりの分割数(2^SYNC_TABLE_BITS)
+  static const int SYNC_TABLE_SIZE = SyncPatternClass::TABLE_SIZE;
+  static const int SYNC_VS_STEPS = SyncPatternClass::VS_STEPS;       // 波形テーブル作成時のVsの量子化段数(Vs=1のときSYNC_VS_STEPS)
+  static const int OVERSAMPLING_MAX = 8;                    // オーバーサンプリング倍率の最大値
+  static const int OVERSAMPLING_STAGE_MAX = 3;              // デシメータの最大段数(log2(OVERSAMPLING_MAX))
+  static const int SPECTRAL_PARTIAL_MAX = 64;               // VVVF_ENGINE_SPECTRAL で合成する正弦波成分の最大数(Vec4f::WIDTHの倍数)
+  static const size_t SPECTRAL_CONTROL_PERIOD = 32;         // VVVF_ENGINE_SPECTRAL で成分の振幅・周波数を計算し直す間隔[サンプル]
+  static const int SPECTRAL_FREQ_MAX = 20000;               // VVVF_ENGINE_SPECTRAL で合成する成分の周波数の上限[Hz]
+  static const int SPECTRAL_VS_STEPS = 1024;                // VVVF_ENGINE_SPECTRAL の非同期モードで成分の一覧を作り直すVsの量子化段数
+  static const int SPECTRAL_K_MAX = 512;                    // 同期モードで調べる信号波の高調波の次数の上限
+  static const int SPECTRAL_EDGE_MAX = 256;                 // 同期モードで扱う1周期あたりの線間電圧の変化点の数の上限
+  static const int SPECTRAL_M_MAX = 16;                     // 非同期モードで調べるキャリア高調波の次数の上限
+  static const int SPECTRAL_N_MAX = 40;                     // 非同期モードで調べる側帯波の次数の上限
+  static const size_t SIMD_BLOCK = 32;                      // SIMDカーネルで一度に処理するサンプル数(Vec4f::WIDTHの倍数)
+  static const size_t CONTROL_BLOCK = PwmControlClass::BLOCK;  // 制御量(信号波周波数・信号波電圧・パルスモード)をまとめて求めるサンプル数
+  static const int CONTROL_PERIOD_MAX = PwmControlClass::PERIOD_MAX;  // 制御周期の上限[サンプル]
+  static const uint8_t PM_INDEX_NONE = PwmControlClass::PM_INDEX_NONE;  // _control.pmIndex で該当するパルスモードがないことを表す値
+  static const int MOTOR_CURRENT_HPF_FREQ = 250;            // 電流モデルの出力の直流分を除くHPFの遮断周波数[Hz]. これ以下の低域のゲインは MOTOR_CURRENT_REF_FREQ / MOTOR_CURRENT_HPF_FREQ 倍で頭打ちになる
+  static const int MOTOR_CURRENT_REF_FREQ = 1000;           // 電流モデルの出力を正規化する周波数[Hz]. この周波数の成分は線間電圧と同じ振幅で出力される
+
   const CarDataClass& _carData;
+  const SineTable& _sineTable;  // 信号波の計算に用いる正弦波テーブル
+  SinePrecision _sinePrecision;  // 信号波の計算精度
+
+  size_t _pmIndex;  // 現在何番目のパルスモードにいるか(3相共通). 該当なしは PM_INDEX_NONE
 
-  size_t _pmIndex[3];  // 各相が何番目のパルスモードにいるか
+  int _controlPeriod;  // 制御量を計算する間隔[サンプル]. 間のサンプルは直線補間する
+  PwmControlClass _control;  // 各サンプルの信号波周波数・信号波電圧と、各制御点のパルスモード
+  float _ctrlEmf[CONTROL_BLOCK];  // 各制御点の相電圧出力の基本波振幅. 電流モデルで誘起電圧として差し引く. 並びは _control.pmIndex と同じ
+
+  int _oversampling;  // オーバーサンプリング倍率(1,2,4,8)
+  int _decimatorStageNum;  // デシメータの段数(log2(_oversampling))
+  double _dt;  // PWMを計算する時間刻み[s]. T_SAMPLE / _oversampling
+  HalfbandDecimator _decimator[OVERSAMPLING_STAGE_MAX][2];  // 2:1デシメータ. [段][線間]. 段0が最も高いレート
 
   float _Vs;  // モータ電圧(0 to 1. 全電圧1パルスモードのとき1)
   float _phaseSin[3];  // 各相の信号波位相
@@ -24,20 +67,98 @@ class VVVFSoundClass {
   float _fc;  // 非同期キャリア周波数(ランダム変調の場合はその中心). この値は同期モードでは意味を持たない
   float _frand;  // ランダム変調幅. この値は同期モードでは意味を持たない
   float _fdeviation;  // ランダムに決定される、キャリア周波数の中心からのずれ
+  uint32_t _randSeed;  // 乱数の種. clear() で乱数の状態はこの値に戻る
+  CarrierRandomClass _random;  // キャリア周波数のランダム変調に用いる乱数
   float _phaseCarrier;  // 非同期搬送波の位相
   float _ampCarrier;  // 非同期搬送波の瞬時値(-1 to 1)
 
+  float _diff[3];  // 各相の信号波とキャリアの差(Vs*sin - キャリア). 0以上のとき相電圧出力は1
   bool _invPhaseV[3];  // 各相の相電圧出力. 0または1
   int _invLineV[3];  // 各線間電圧出力. -1,0,1 のどれか. 順番はU-V, V-W, W-Uの順
   FirstLPF _firstLPF0;  // U-V線間のLPF
   FirstLPF _firstLPF1;  // V-W線間のLPF
   int _volume;  // 再生時の音量(0-32767)
+  bool _isMotorCurrentEnabled;  // 線間電圧の代わりに主電動機の電流モデルの出力を用いるかどうか
+  FirstIIR _motorCurrent[2];  // 主電動機のRL回路. [線間]
+  FirstHPF _motorCurrentHPF[2];  // 電流モデルの出力から低域を除くHPF. [線間]
+
+  VVVFEngine _engine;  // 波形生成方式
+  float _blepDiff[3];  // VVVF_ENGINE_BLEP: 1サンプル前の _diff
+  bool _blepPhaseV[3];  // VVVF_ENGINE_BLEP: 1サンプル前の _invPhaseV
+  float _blepLineV[2];  // VVVF_ENGINE_BLEP: 出力待ちの1サンプル前の線間電圧(補正込み)
+  int _blepPiece;  // VVVF_ENGINE_BLEP: キャリアが直線である区間の番号. 非同期では0:上り,1:下り. 同期ではU相の信号波1周期内の番号. -1は未計算
+  bool _blepEdgePending[3];  // VVVF_ENGINE_BLEP: 現在の区間でまだ出力していないスイッチングがあるかどうか
+  float _blepEdgeTime[3];  // VVVF_ENGINE_BLEP: まだ出力していないスイッチングの時刻. 現在のサンプルからの相対時刻[サンプル]
+  int _spectralPartialNum;  // VVVF_ENGINE_SPECTRAL: 合成する成分数の上限
+  int _specNum;  // VVVF_ENGINE_SPECTRAL: 現在の成分数
+  int _specPmIndex;  // VVVF_ENGINE_SPECTRAL: 成分の一覧を作ったときのパルスモード. -1のときは未作成
+  int _specVsStep;  // VVVF_ENGINE_SPECTRAL: 成分の一覧を作ったときの量子化したVs
+  int _specRangeStep;  // VVVF_ENGINE_SPECTRAL: 成分の一覧を作ったときの成分の取捨に影響する周波数. 非同期では信号波周波数(1Hz単位), 同期では高調波の次数の上限
+  float _specM[SPECTRAL_PARTIAL_MAX];  // VVVF_ENGINE_SPECTRAL: 各成分の位相に含まれるキャリア位相の係数
+  float _specN[SPECTRAL_PARTIAL_MAX];  // VVVF_ENGINE_SPECTRAL: 各成分の位相に含まれるU相の信号波位相の係数
+  float _specCoef[4][SPECTRAL_PARTIAL_MAX];  // VVVF_ENGINE_SPECTRAL: 各成分のsin,cosにかける係数. U-V線間のsin,cos, V-W線間のsin,cosの順
+
+#ifdef USE_FIXED_POINT
+  uint32_t _phaseSinQ;      // W相の信号波位相. 2^32で1周期. U,V相はこれに2/3,1/3周期を足したもの
+  uint32_t _phaseCarrierQ;  // 非同期搬送波の位相. 2^32で1周期
+  uint32_t _incCarrierQ;    // 非同期搬送波の1サンプルあたりの位相増分. 0のときは未計算
+  int32_t _ampCarrierQ;     // 搬送波の瞬時値(Q15)
+  int32_t _VsQ;             // モータ電圧(Q15)
+#endif
+
+  SyncCarrierClass _syncCarrier;  // 現在の同期モードのキャリア波形
+  bool _isSyncCacheEnabled;  // 同期モードで波形テーブルを用いるかどうか
+  SyncPatternCacheClass _syncCache;  // 同期モードの波形テーブルのキャッシュ
   
-  size_t getPulsemodeIndex(const float fs);
+  void calcControl(const float* speed, size_t num, size_t remain, float coeffSpdToFs);
+  void renderBlock(uint8_t* buf, size_t num);
+  size_t findSegmentEnd(size_t begin, size_t num);
+  void renderAsync(uint8_t* buf, size_t begin, size_t end);
+  void renderSync(uint8_t* buf, size_t begin, size_t end);
+  void renderAsyncSimd(uint8_t* buf, size_t begin, size_t end);
+  void renderSyncSimd(uint8_t* buf, size_t begin, size_t end);
+  void comparePhasesSimd(uint8_t* buf, size_t begin, size_t num, const float* phase, const float* vs, const float* carrier);
+  inline void finishBlockSimd(size_t num, float* phase, float* vs, float* carrier);
+  void renderOversampled(uint8_t* buf, size_t begin, size_t end);
+  inline float decimate(float* x, const size_t i_line);
+  void renderSyncCached(uint8_t* buf, size_t begin, size_t end);
+  void renderAsyncBlep(uint8_t* buf, size_t begin, size_t end);
+  void renderSyncBlep(uint8_t* buf, size_t begin, size_t end);
+  const SyncPatternClass& getSyncPattern(const size_t pmIndex, const int vsStep);
+  void renderSpectral(uint8_t* buf, size_t begin, size_t end);
+  void buildSpectralAsync(const float fs, const float fc);
+  int addSpectralPartial(const int m, const int n, const float legAmp, const int offset);
+  void buildSpectralSync(const size_t pmIndex, const int kMax, const int vsStep);
+  static void calcBesselJ(const float x, const int nMax, float* J);
+  void renderHold(uint8_t* buf, size_t begin, size_t end);
+  void applyMotorCurrent(uint8_t* buf, size_t num, float phaseStart);
+  float calcFundamental(const int pmIndex, const float Vs);
+#ifdef USE_FIXED_POINT
+  void renderAsyncFixed(uint8_t* buf, size_t begin, size_t end);
+  void renderSyncFixed(uint8_t* buf, size_t begin, size_t end);
+  void renderSyncCachedFixed(uint8_t* buf, size_t begin, size_t end);
+  void renderHoldFixed(uint8_t* buf, size_t begin, size_t end);
+  inline void advancePhaseFixed(const float fs, const float vs);
+  inline void comparePhasesFixed();
+#endif
+  inline void advancePhase(const float fs);
+  inline int currentMode() const;
+  inline void writeSample(uint8_t* buf, const size_t i);
+  inline void writeSampleBlep(uint8_t* buf, const size_t i);
+  inline void addBlepResidual(const size_t i_phase, const float a, float* lineV);
+  inline void applyBlepEdge(const size_t i_phase, const float t, float* lineV);
+  inline void applyDueBlepEdges(float* lineV);
+  inline void startBlepPiece(const float cStart, const float slope, const float tStart, const float tEnd, const float dPhase, float* lineV);
+  inline void outputBlep(uint8_t* buf, const size_t i, const float* lineV);
+  inline size_t renderBlepInside(uint8_t* buf, size_t i, const size_t end, float tEnd, const bool advanceCarrier);
+  inline size_t countBlepSteady(const size_t remain, const float tEnd) const;
+  inline void outputBlepSteady(uint8_t* buf, const size_t i, const size_t count, const bool advanceCarrier);
+  inline void advanceBlepPhase(const size_t i, const size_t count, const bool advanceCarrier);
+  void finishBlep();
+  void clearBlep();
   inline void calcAsyncTriangle(const float fs, const size_t pmIndex);
   inline void asyncPWM(const size_t i_phase);
-  inline void calcSyncTriangle(const float phaseSin, const int Npulse);
-  inline void calcSyncNot3xPTriangle(const float phaseSin, const int Npulse);
+  inline void calcSyncCarrier(const float phaseSin);
   inline void syncPWM(const size_t i_phase);
 
  public:
@@ -55,15 +176,87 @@ class VVVFSoundClass {
   /// @retval 1:success, 0:fail
   int setVolume(int volume);
 
+  /// @brief キャリア周波数のランダム変調に用いる乱数の種を設定し、乱数の状態を初期化する.
+  ///        乱数はインスタンスごとに独立なので、同じ種からは常に同じ音が生成される
+  /// @param[in] seed 乱数の種. 0は使えない
+  /// @retval 1:success, 0:fail
+  int setSeed(uint32_t seed);
+
+  /// @brief 信号波(正弦波)の計算精度を設定する. 既定値は SINE_PRECISION_LERP.
+  ///        VVVF_ENGINE_COMPARATOR で SINE_PRECISION_LERP の場合、3相の比較はSIMDカーネルで行われ、
+  ///        信号波は同程度の精度の多項式で計算される. VVVF_ENGINE_SPECTRAL の各成分の初期位相と回転も同様.
+  ///        SINE_PRECISION_TABLE, SINE_PRECISION_LIBM ではスカラで計算し、指定した精度の正弦波を用いる
+  /// @param[in] precision 計算精度
+  /// @retval 1:success, 0:fail
+  int setSinePrecision(SinePrecision precision);
+
+  /// @brief 波形生成方式を設定する. 既定値は VVVF_ENGINE_COMPARATOR.
+  ///        VVVF_ENGINE_BLEP ではエッジが帯域制限されるのでエイリアシングが減り、setCutoffFreq() のLPFは不要になる.
+  ///        非同期・同期モードでは、キャリアが直線である区間に入るたびに区間内のスイッチング時刻を信号波との交点として求め、
+  ///        スイッチングの間のサンプルは比較を行わずに生成する. このため同期モードの波形テーブル(setSyncCacheEnabled)は用いられない.
+  ///        スイッチング角を指定するモードでは、スイッチング時刻をサンプル間の中央とみなして帯域制限する.
+  ///        VVVF_ENGINE_SPECTRAL では各モードを、可聴域(SPECTRAL_FREQ_MAX未満)の正弦波成分の和で生成する.
+  ///        計算量はサンプリング周波数ではなく成分数(setSpectralPartialNum)で決まる.
+  ///        USE_FIXED_POINT 定義時は VVVF_ENGINE_COMPARATOR のみ設定できる
+  /// @param[in] engine 波形生成方式
+  /// @retval 1:success, 0:fail
+  int setEngine(VVVFEngine engine);
+
+  /// @brief VVVF_ENGINE_SPECTRAL で合成する正弦波成分の数の上限を設定する. 既定値は32.
+  ///        成分は基本波、キャリアの低次の高調波群の順に、側帯波の次数の低いものから選ばれる
+  /// @param[in] num 成分数(1 to SPECTRAL_PARTIAL_MAX)
+  /// @retval 1:success, 0:fail
+  int setSpectralPartialNum(int num);
+
+  /// @brief オーバーサンプリング倍率を設定する. 既定値は1(オーバーサンプリングなし).
+  ///        2以上のときPWMを倍率倍のサンプリングレートで計算し、2:1のハーフバンドデシメータを重ねて44.1kHzに戻すので、
+  ///        キャリア高調波の折り返しが減る. 計算量はおおよそ倍率に比例する. このとき VVVF_ENGINE_BLEP は用いられない.
+  ///        VVVF_ENGINE_SPECTRAL はもともと帯域制限されているのでオーバーサンプリングしない
+  /// @param[in] factor 倍率. 1,2,4,8のいずれか. USE_FIXED_POINT 定義時は1のみ
+  /// @retval 1:success, 0:fail
+  int setOversampling(int factor);
+
+  /// @brief 同期モードにおいて、1周期ぶんの波形テーブルをキャッシュして用いるかどうか設定する. 既定値は有効.
+  ///        有効にするとキャリアと比較器の計算がテーブル参照に置き換わる. VsはSYNC_VS_STEPS段階に、
+  ///        位相はSYNC_TABLE_SIZE分割に量子化される. USE_FIXED_POINT 定義時は用いられない.
+  ///        スイッチング角を指定するモード(SYNC_W3P, SYNC_1P, SYNC_ANGLE)はこの設定によらず常に波形テーブルで生成する
+  /// @param[in] isEnabled 用いる場合1, 用いない場合0をセット
+  /// @retval 1:success, 0:fail
+  int setSyncCacheEnabled(bool isEnabled);
+
+  /// @brief 信号波周波数・信号波電圧(Vs)・パルスモードを計算する間隔(制御周期)を設定する. 既定値は32.
+  ///        制御点では走行速度からこれらを求め、制御点の間の信号波周波数とVsは次の制御点の値へ直線補間する.
+  ///        サンプルごとに行うのは信号波・キャリアの位相の積分と比較だけになる. 非同期キャリア周波数は従来どおりキャリア1周ごとに補間後の信号波周波数から求める.
+  ///        走行速度がサンプル間で直線的に変化する場合、信号波周波数の誤差は丸め誤差のみで、Vsの誤差は
+  ///        最大電圧に達する周波数(modulationMaxFreq)をまたぐ1制御周期の間だけ生じる(折れ線を弦で近似するため).
+  ///        パルスモードの切り替わりは最大で制御周期-1サンプル遅れる(32のとき0.7ms). 1のときは全サンプルで計算する
+  /// @param[in] period 制御周期[サンプル](1 to CONTROL_PERIOD_MAX)
+  /// @retval 1:success, 0:fail
+  int setControlPeriod(int period);
+
+  /// @brief 出力を線間電圧から主電動機の電流モデルに切り替えるかどうか設定する. 既定値は無効.
+  ///        各相の巻線を車両データの motorInductance, motorResistance からなるRL回路とみなし、線間電圧から2相の電流の差を求める.
+  ///        誘起電圧は相電圧の基本波に等しいとみなして差し引くので、出力は主にPWMによる電流リプル(磁励音の源)になる.
+  ///        インダクタンスによって高域が-6dB/octで減衰するので、キャリア高調波の折り返しも小さくなる.
+  ///        MOTOR_CURRENT_REF_FREQ の成分が線間電圧と同じ振幅になるよう正規化する. 係数は有効にしたときの車両データで決まる.
+  ///        直流分は MOTOR_CURRENT_HPF_FREQ のHPFで除き、それ以下の低域のゲインは4倍(12dB)で頭打ちにする.
+  ///        それでも低いキャリア周波数の区間では出力のピークが線間電圧(±volume)の2倍程度になるので、volume は15000以下とすること.
+  ///        USE_FIXED_POINT 定義時は用いられない
+  /// @param[in] isEnabled 用いる場合1, 用いない場合0をセット
+  /// @retval 1:success, 0:fail(車両データにインダクタンス・抵抗がない場合など)
+  int setMotorCurrentEnabled(bool isEnabled);
+
   /// @brief モーター音のカットオフ周波数を指定する
   /// @param[in] fcutoff カットオフ周波数[Hz]
   /// @retval 1:success, 0:fail
   int setCutoffFreq(float fcutoff);
 
-  /// @brief ある速度における音データをsize[bytes]ぶん生成する
+  /// @brief ある速度における音データをsize[bytes]ぶん生成する.
+  ///        CONTROL_BLOCK サンプルごとに制御量を求めた後、パルスモードが一定の区間(セグメント)ごとに分割し、
+  ///        各区間はモード専用のループで計算する
   /// @param[out] buf 生成したPCMデータが格納されるバッファへのポインタ
   /// @param[in] size 生成する音データのサイズ(bytes). サンプル数は size/4 個になる
-  /// @param[in] fs 各サンプリング点における信号波周波数[Hz]を size/4 個ぶん格納した配列
+  /// @param[in] speed 各サンプリング点における走行速度[km/h]を size/4 個ぶん格納した配列
   /// @retval 1:success, 0:fail
   int generateSound(uint8_t* buf, int size, float* fs);
 };
@@ -11,3 +11,13 @@
 
 #define SAMPLINGRATE 44100
 #define T_SAMPLE (1.0/SAMPLINGRATE)
+
+// 定義すると、VVVF音・モーター音・ジョイント音を固定小数点演算(整数の位相アキュムレータ, Q15の振幅)で生成する.
+// ESP32のFPUは単精度のみで倍精度演算はソフトウェア処理になるため、浮動小数点版より高速に動作する.
+// 浮動小数点版との差(許容範囲): VVVF音はエッジが最大1サンプルずれる(全サンプルの0.1%以下),
+// モーター音・ジョイント音は出力の誤差が±8LSB以内. VVVF音は比較器方式のみで、波形テーブルやBLEPは用いない
+// #define USE_FIXED_POINT
+
+#define PI_F 3.14159265f                           // 単精度のπ
+#define T_SAMPLE_F (1.0f/SAMPLINGRATE)             // 単精度のサンプリング周期
+#define PHASE_PER_HZ (4294967296.0f/SAMPLINGRATE)  // 周波数[Hz]を、2^32で1周期とする位相の1サンプルあたりの増分に換算する係数